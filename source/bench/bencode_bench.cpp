@@ -0,0 +1,241 @@
+#include "BEncode.hpp"
+#include "BEncodeTape.hpp"
+#include "BEncodeScan.hpp"
+#include "BEncodeWriter.hpp"
+
+#include <print>
+#include <format>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <functional>
+
+// bencode_bench [file...]
+// parses, re-encodes and scans each input with the old and the new code and prints the throughput of both
+// without arguments it runs on generated inputs shaped like a large multi-file torrent and a dictionary model tracker response
+
+namespace {
+    // the per-digit loop BEncodeParser used before scan_digits()
+    size_t scalar_digits(std::string_view data, size_t pos) {
+        while (pos < data.size() && data[pos] >= '0' && data[pos] <= '9') ++pos;
+        return pos;
+    }
+
+    // writer counterpart of the bencode code that was spread around the tree before BEncodeWriter
+    void hand_encode(const BEncodeValue& v, std::string& out) {
+        if (v.is_int()) {
+            out += 'i';
+            out += std::to_string(v.as_int());
+            out += 'e';
+        }
+        else if (v.is_string()) {
+            auto s = v.as_string();
+            out += std::to_string(s.size());
+            out += ':';
+            out += s;
+        }
+        else if (v.is_list()) {
+            out += 'l';
+            for (const auto& element: v.as_list()) hand_encode(element, out);
+            out += 'e';
+        }
+        else {
+            out += 'd';
+            for (const auto& [name, element]: v.as_dict()) {
+                out += std::to_string(name.size());
+                out += ':';
+                out += name;
+                hand_encode(element, out);
+            }
+            out += 'e';
+        }
+    }
+
+    // sized with a counting pass first, so the output is allocated once
+    std::string writer_encode(const BEncodeValue& v) {
+        BEncodeWriter<BEncodeCounter> counter(BEncodeCounter{});
+        counter.value(v);
+
+        std::string out(counter.sink().size, '\0');
+        BEncodeWriter<BEncodeSpanSink> writer(BEncodeSpanSink{ out });
+        writer.value(v);
+
+        return out;
+    }
+
+    // every length prefix and integer in the input, found by walking it once
+    std::vector<size_t> digit_runs(std::string_view data) {
+        std::vector<size_t> runs;
+
+        for (size_t pos{}; pos < data.size();) {
+            char c = data[pos];
+
+            if (c == 'i') {
+                pos += data[pos + 1] == '-' ? 2 : 1;
+                runs.push_back(pos);
+                pos = scalar_digits(data, pos) + 1;
+            }
+            else if (c >= '0' && c <= '9') {
+                runs.push_back(pos);
+                auto colon = scalar_digits(data, pos);
+                pos = colon + 1 + std::stoull(std::string(data.substr(pos, colon - pos)));
+            }
+            else ++pos;
+        }
+
+        return runs;
+    }
+
+    // repeats until at least half a second has passed, returns MB/s over the input
+    double throughput(size_t bytes, const std::function<void()>& run) {
+        using clock = std::chrono::steady_clock;
+
+        run();
+
+        size_t rounds{};
+        auto start = clock::now();
+        std::chrono::duration<double> elapsed{};
+
+        do {
+            run();
+            ++rounds;
+            elapsed = clock::now() - start;
+        } while (elapsed.count() < 0.5);
+
+        return bytes * rounds / 1e6 / elapsed.count();
+    }
+
+    void report(std::string_view what, double before, double after) {
+        std::println("  {:<28} {:>9.1f} MB/s  {:>9.1f} MB/s  {:>5.2f}x", what, before, after, after / before);
+    }
+
+    std::string random_bytes(std::mt19937_64& rng, size_t n) {
+        std::string out(n, '\0');
+        for (auto& c: out) c = static_cast<char>(rng());
+        return out;
+    }
+
+    using StringWriter = BEncodeWriter<BEncodeDynamicSink<boost::asio::dynamic_string_buffer<char, std::char_traits<char>, std::allocator<char>>>>;
+
+    std::string large_torrent(size_t num_files) {
+        std::mt19937_64 rng(1);
+        const uint64_t piece_length = 4 * 1024 * 1024;
+
+        std::string out;
+        StringWriter w({ boost::asio::dynamic_buffer(out) });
+
+        w.begin_dict();
+        w.entry("announce", "http://tracker.example.org:6969/announce");
+        w.entry("creation date", 1700000000);
+
+        w.key("info");
+        w.begin_dict();
+
+        uint64_t total{};
+
+        w.key("files");
+        w.begin_list();
+        for (size_t i{}; i < num_files; ++i) {
+            auto length = rng() % (64ull * 1024 * 1024);
+            total += length;
+
+            w.begin_dict();
+            w.entry("length", static_cast<int64_t>(length));
+            w.key("path");
+            w.begin_list();
+            w.string(std::format("season {}", i / 1000));
+            w.string(std::format("disc {}", i / 100 % 10));
+            w.string(std::format("track {}.flac", i));
+            w.end();
+            w.end();
+        }
+        w.end();
+
+        w.entry("name", "collection");
+        w.entry("piece length", static_cast<int64_t>(piece_length));
+        w.entry("pieces", random_bytes(rng, (total + piece_length - 1) / piece_length * 20));
+        w.end();
+
+        w.end();
+        return out;
+    }
+
+    std::string tracker_response(size_t num_peers) {
+        std::mt19937_64 rng(2);
+
+        std::string out;
+        StringWriter w({ boost::asio::dynamic_buffer(out) });
+
+        w.begin_dict();
+        w.entry("complete", 4210);
+        w.entry("incomplete", 377);
+        w.entry("interval", 1800);
+
+        w.key("peers");
+        w.begin_list();
+        for (size_t i{}; i < num_peers; ++i) {
+            w.begin_dict();
+            w.entry("ip", std::format("{}.{}.{}.{}", rng() % 256, rng() % 256, rng() % 256, rng() % 256));
+            w.entry("peer id", random_bytes(rng, 20));
+            w.entry("port", static_cast<int64_t>(rng() % 65536));
+            w.end();
+        }
+        w.end();
+
+        w.end();
+        return out;
+    }
+
+    void bench(std::string_view name, const std::string& input) {
+        std::println("{} ({} bytes)", name, input.size());
+        std::println("  {:<28} {:>14}  {:>14}", "", "before", "after");
+
+        // BEncodeParser against the tape
+        auto tree = throughput(input.size(), [&] { BEncodeParser(input).parse(); });
+        auto tape = throughput(input.size(), [&] { BEncodeTapeParser(input).parse(); });
+        report("parse: tree / tape", tree, tape);
+
+        // hand serialization against the writer, both have to give back the input
+        auto value = BEncodeParser(input).parse();
+
+        std::string hand;
+        hand_encode(value, hand);
+        if (hand != input || writer_encode(value) != input) std::println("  encoders don't round trip, input isn't canonical bencode");
+
+        auto by_hand = throughput(input.size(), [&] { std::string out; hand_encode(value, out); });
+        auto by_writer = throughput(input.size(), [&] { writer_encode(value); });
+        report("encode: hand / writer sized", by_hand, by_writer);
+
+        auto by_stream = throughput(input.size(), [&] { std::string out; StringWriter({ boost::asio::dynamic_buffer(out) }).value(value); });
+        report("encode: hand / writer stream", by_hand, by_stream);
+
+        // the digit runs alone, scalar loop against scan_digits
+        auto runs = digit_runs(input);
+        size_t sink{};
+
+        auto scalar = throughput(input.size(), [&] { for (auto pos: runs) sink += scalar_digits(input, pos); });
+        auto simd = throughput(input.size(), [&] { for (auto pos: runs) sink += scan_digits(input, pos); });
+        report(std::format("scan: scalar / simd, {} runs", runs.size()), scalar, simd);
+
+        if (sink == 0) std::println("");
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) {
+            std::ifstream in(argv[i], std::ios::binary);
+            if (!in) { std::println("Can't open {}", argv[i]); return 1; }
+
+            std::string input((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            bench(argv[i], input);
+        }
+        return 0;
+    }
+
+    bench("torrent, 50000 files", large_torrent(50000));
+    bench("tracker response, 5000 dict peers", tracker_response(5000));
+}
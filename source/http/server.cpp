@@ -3,12 +3,15 @@
 #include "TorrentSnapshot.hpp"
 #include "PeerSnapshot.hpp"
 #include "TrackerSnapshot.hpp"
+#include "TorrentCreator.hpp"
+#include "NativeFile.hpp"
 
 #include <boost/asio/awaitable.hpp>
 #include <boost/asio/use_awaitable.hpp>
 #include <boost/asio/experimental/awaitable_operators.hpp>
 #include <boost/beast.hpp>
 #include <fstream>
+#include <algorithm>
 #include <iostream>
 #include <filesystem>
 
@@ -19,8 +22,8 @@ using namespace boost::asio::experimental::awaitable_operators;
 namespace http = boost::beast::http;
 namespace net = boost::asio;
 
-HttpServer::HttpServer(boost::asio::any_io_executor exec, unsigned short port, std::string doc_root, Client* client)
-    : _exec(exec), _port(port), _doc_root(std::move(doc_root)), _client(client) {}
+HttpServer::HttpServer(boost::asio::any_io_executor exec, unsigned short port, std::string doc_root, std::filesystem::path share_root, Client* client)
+    : _exec(exec), _port(port), _doc_root(std::move(doc_root)), _share_root(std::move(share_root)), _client(client) {}
 
 // -------------------- utility functions --------------------
 
@@ -30,6 +33,25 @@ std::string HttpServer::load_file(const std::string& path) {
     return std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
 }
 
+std::optional<std::filesystem::path> HttpServer::resolve_shared(std::string_view relative) const {
+    std::filesystem::path path(relative);
+    if (path.empty() || path.has_root_name() || path.has_root_directory()) return std::nullopt;
+    if (std::ranges::any_of(path, [](const auto& part) { return part == ".."; })) return std::nullopt;
+
+    // a symlink inside the share can still point out of it, so compare the resolved paths
+    std::error_code ec;
+    auto root = std::filesystem::weakly_canonical(_share_root, ec);
+    if (ec) return std::nullopt;
+
+    auto full = std::filesystem::weakly_canonical(root / path, ec);
+    if (ec) return std::nullopt;
+
+    auto [root_end, full_end] = std::mismatch(root.begin(), root.end(), full.begin(), full.end());
+    if (root_end != root.end()) return std::nullopt;
+
+    return full;
+}
+
 std::string HttpServer::mime_type(const std::string& path) {
     if (path.ends_with(".html")) return "text/html";
     if (path.ends_with(".css"))  return "text/css";
@@ -54,20 +76,22 @@ UploadedFile HttpServer::parse_multipart(const http::request<http::dynamic_body>
     std::string boundary = get_boundary(req);
     if (boundary.empty()) return result;
 
-    std::string body = boost::beast::buffers_to_string(req.body().data());
+    // one copy to flatten the body, parts are views into it until the torrent is copied out once
+    std::string body_buffer = boost::beast::buffers_to_string(req.body().data());
+    std::string_view body = body_buffer;
     std::string marker = "--" + boundary;
     size_t pos = 0;
 
-    while ((pos = body.find(marker, pos)) != std::string::npos) {
+    while ((pos = body.find(marker, pos)) != std::string_view::npos) {
         size_t header_end = body.find("\r\n\r\n", pos);
-        if (header_end == std::string::npos) break;
+        if (header_end == std::string_view::npos) break;
 
-        std::string header = body.substr(pos, header_end - pos);
+        auto header = body.substr(pos, header_end - pos);
         size_t data_start = header_end + 4;
         size_t next_marker = body.find(marker, data_start);
-        if (next_marker == std::string::npos) break;
+        if (next_marker == std::string_view::npos) break;
 
-        std::string part_data = body.substr(data_start, next_marker - data_start);
+        auto part_data = body.substr(data_start, next_marker - data_start);
 
         if (header.find("name=\"torrent\"") != std::string::npos) {
             size_t fn = header.find("filename=\"");
@@ -80,6 +104,12 @@ UploadedFile HttpServer::parse_multipart(const http::request<http::dynamic_body>
             result.valid = true;
         }
 
+        // optional storage backend, "positional", "mmap", "async" or "direct"
+        if (header.find("name=\"storage\"") != std::string::npos) result.storage = part_data.substr(0, part_data.find("\r\n"));
+
+        // optional allocation mode, "sparse", "full" or "none"
+        if (header.find("name=\"allocation\"") != std::string::npos) result.allocation = part_data.substr(0, part_data.find("\r\n"));
+
         pos = next_marker;
     }
 
@@ -127,11 +157,13 @@ boost::asio::awaitable<void> HttpServer::handle_api(const http::request<http::dy
 
     if (req.method() == http::verb::post) {
         if (req.target() == "/api/torrents/add") { handle_add_torrent(req, res); co_return; }
+        if (req.target() == "/api/torrents/create") { co_await handle_create_torrent(req, res); co_return; }
         if (args.back() == "remove") { co_await handle_delete_torrent(req, res, args[3]); co_return; }
     }
 
     if (req.method() == http::verb::get) {
         if (req.target() == "/api/torrents") { fetch_torrents_info(req, res); co_return; }
+        if (req.target() == "/api/disk") { fetch_disk_stats(req, res); co_return; }
         if (args.back() == "peers") { fetch_peers_info(req, res, args[3]); co_return; } // hash
         if (args.back() == "trackers") { fetch_trackers_info(req, res, args[3]); co_return; }// hash
     }co_return
@@ -187,6 +219,12 @@ void HttpServer::fetch_trackers_info(const http::request<http::dynamic_body>& re
         obj["status"] = snapshot.status;
         obj["timer"] = snapshot.next_in;
 
+        if (snapshot.scraped) {
+            obj["seeders"] = snapshot.seeders;
+            obj["leechers"] = snapshot.leechers;
+            obj["completed"] = snapshot.completed;
+        }
+
         arr.push_back(std::move(obj));
     }
 
@@ -209,7 +247,14 @@ void HttpServer::handle_add_torrent(const http::request<http::dynamic_body>& req
         return;
     }
 
-    auto result = _client->add_torrent(file.data);
+    auto mode = file.storage == "mmap"   ? StorageMode::Mmap
+              : file.storage == "async"  ? StorageMode::AsyncFile
+              : file.storage == "direct" ? StorageMode::Direct
+              : StorageMode::Positional;
+    auto allocation = file.allocation == "full" ? AllocationMode::Full
+                    : file.allocation == "none" ? AllocationMode::None
+                    : AllocationMode::Sparse;
+    auto result = _client->add_torrent(std::move(file.data), mode, allocation);
 
     boost::json::object obj;
     obj["status"]  = result.success ? "ok" : "error";
@@ -223,6 +268,61 @@ void HttpServer::handle_add_torrent(const http::request<http::dynamic_body>& req
     res.prepare_payload();
 }
 
+// hashing runs off the io threads, the connection just waits for it
+boost::asio::awaitable<void> HttpServer::handle_create_torrent(const http::request<http::dynamic_body>& req, http::response<http::string_body>& res) {
+    boost::json::object obj;
+
+    try {
+        auto body = boost::beast::buffers_to_string(req.body().data());
+        auto json = boost::json::parse(body).as_object();
+
+        // the api is reachable from the network, so it only reads from and writes into the share root
+        auto source = resolve_shared(std::string(json.at("path").as_string()));
+        if (!source) throw std::runtime_error("path must be inside the share root");
+
+        CreateTorrentOptions options;
+        options.source = *source;
+        options.follow_symlinks = false;
+
+        if (auto* trackers = json.if_contains("trackers")) {
+            for (const auto& tracker: trackers->as_array()) options.trackers.emplace_back(tracker.as_string());
+        }
+        if (auto* comment = json.if_contains("comment")) options.comment = comment->as_string();
+        if (auto* piece_length = json.if_contains("piece_length")) options.piece_length = piece_length->to_number<uint64_t>();
+        if (auto* is_private = json.if_contains("private")) options.is_private = is_private->as_bool();
+
+        auto created = co_await _client->create_torrent(std::move(options));
+
+        std::string output_name = created.name + ".torrent";
+        if (auto* out = json.if_contains("output")) output_name = std::string(out->as_string());
+
+        // only ever a .torrent file, so a request can't replace the data it was made from
+        auto output_path = resolve_shared(output_name);
+        if (!output_path || output_path->extension() != ".torrent") throw std::runtime_error("output must be a .torrent file inside the share root");
+        const auto& output = *output_path;
+
+        std::span bytes(reinterpret_cast<const unsigned char*>(created.data.data()), created.data.size());
+        if (!write_file_atomic(output, bytes)) throw std::runtime_error("Could not write " + output.string());
+
+        obj["status"] = "ok";
+        obj["hash"] = created.info_hash_hex;
+        obj["name"] = created.name;
+        obj["size"] = created.total_size;
+        obj["pieces"] = created.num_pieces;
+        obj["piece_length"] = created.piece_length;
+        obj["output"] = output.string();
+    }
+    catch (const std::exception& ex) {
+        obj["status"] = "error";
+        obj["message"] = ex.what();
+    }
+
+    res.result(http::status::ok);
+    res.set(http::field::content_type, "application/json");
+    res.body() = boost::json::serialize(obj);
+    res.prepare_payload();
+}
+
 boost::asio::awaitable<void> HttpServer::handle_delete_torrent(const http::request<http::dynamic_body>& req, http::response<http::string_body>& res, const std::string& hash) {
     boost::json::object obj;
 
@@ -258,6 +358,16 @@ void HttpServer::fetch_torrents_info(const http::request<http::dynamic_body>& re
         obj["status"] = snapshot.status;
         obj["peers"] = snapshot.peers;
         obj["trackers"] = snapshot.trackers;
+        obj["disk_queue_bytes"] = snapshot.disk_queue_bytes;
+        obj["disk_queue_jobs"] = snapshot.disk_queue_jobs;
+        obj["disk_throttled"] = snapshot.disk_throttled;
+        obj["disk_read_rate"] = snapshot.disk.read_rate;
+        obj["disk_write_rate"] = snapshot.disk.write_rate;
+        obj["disk_read_p99_us"] = snapshot.disk.read.p99_us;
+        obj["disk_write_p99_us"] = snapshot.disk.write.p99_us;
+        obj["disk_wait_p99_us"] = snapshot.disk.queue_wait.p99_us;
+        obj["hash_p99_us"] = snapshot.disk.hash.p99_us;
+        obj["disk_pending"] = snapshot.disk.pending;
 
         arr.push_back(std::move(obj));
     }
@@ -268,6 +378,67 @@ void HttpServer::fetch_torrents_info(const http::request<http::dynamic_body>& re
     res.prepare_payload();    
 }
 
+namespace {
+    boost::json::object latency_json(const LatencySnapshot& latency) {
+        boost::json::object obj;
+
+        obj["count"] = latency.count;
+        obj["mean_us"] = latency.mean_us;
+        obj["p50_us"] = latency.p50_us;
+        obj["p99_us"] = latency.p99_us;
+        obj["max_us"] = latency.max_us;
+        obj["buckets"] = boost::json::array(latency.buckets.begin(), latency.buckets.end());
+
+        return obj;
+    }
+}
+
+// latency histograms per torrent, buckets[i] counts operations that took under 2^i microseconds
+void HttpServer::fetch_disk_stats(const http::request<http::dynamic_body>& req, http::response<http::string_body>& res) {
+    boost::json::array devices;
+
+    for (const auto& device: _client->get_disk_device_stats()) {
+        boost::json::object obj;
+
+        obj["device"] = device.device;
+        obj["queued"] = device.queued;
+        obj["in_flight"] = device.in_flight;
+
+        devices.push_back(std::move(obj));
+    }
+
+    boost::json::array torrents;
+
+    for (const auto& snapshot: _client->get_torrent_snapshots()) {
+        boost::json::object obj;
+
+        obj["name"] = snapshot.name;
+        obj["hash"] = snapshot.hash;
+        obj["read"] = latency_json(snapshot.disk.read);
+        obj["write"] = latency_json(snapshot.disk.write);
+        obj["hash_check"] = latency_json(snapshot.disk.hash);
+        obj["queue_wait"] = latency_json(snapshot.disk.queue_wait);
+        obj["bytes_read"] = snapshot.disk.bytes_read;
+        obj["bytes_written"] = snapshot.disk.bytes_written;
+        obj["read_rate"] = snapshot.disk.read_rate;
+        obj["write_rate"] = snapshot.disk.write_rate;
+        obj["pending"] = snapshot.disk.pending;
+        obj["queue_bytes"] = snapshot.disk_queue_bytes;
+        obj["queue_jobs"] = snapshot.disk_queue_jobs;
+
+        torrents.push_back(std::move(obj));
+    }
+
+    boost::json::object out;
+    out["devices"] = std::move(devices);
+    out["torrents"] = std::move(torrents);
+
+    res.result(http::status::ok);
+    res.set(http::field::content_type, "application/json");
+    res.body() = boost::json::serialize(out);
+    res.prepare_payload();
+}
+
 // -------------------- async accept loop --------------------
 
 awaitable<void> HttpServer::accept_loop(tcp::acceptor acceptor) {
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+
+// fixed size buffers with a start address suitable for direct I/O
+// a released buffer goes back on the idle list rather than to the allocator, up to max_idle of them
+class AlignedBufferPool {
+public:
+    AlignedBufferPool(size_t buffer_size, size_t alignment, size_t max_idle): _buffer_size(buffer_size), _alignment(alignment), _max_idle(max_idle) {}
+    ~AlignedBufferPool();
+
+    AlignedBufferPool(const AlignedBufferPool&) = delete;
+    AlignedBufferPool& operator=(const AlignedBufferPool&) = delete;
+
+    struct Release {
+        AlignedBufferPool* pool;
+        void operator()(unsigned char* data) const { pool->release(data); }
+    };
+
+    using Buffer = std::unique_ptr<unsigned char[], Release>;
+
+    Buffer acquire();
+    size_t buffer_size() const { return _buffer_size; }
+
+private:
+    void release(unsigned char* data);
+    void free(unsigned char* data) const;
+
+    size_t _buffer_size, _alignment, _max_idle;
+
+    std::vector<unsigned char*> _idle;
+    std::mutex _mutex;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+#include <boost/asio.hpp>
+
+// hands out announce slots for every torrent, so a client with many torrents doesn't hit the network in bursts
+// announces are spaced out globally, and further apart when they go to the same host
+class AnnounceScheduler {
+public:
+    explicit AnnounceScheduler(boost::asio::any_io_executor exec);
+
+    AnnounceScheduler(const AnnounceScheduler&) = delete;
+    AnnounceScheduler& operator=(const AnnounceScheduler&) = delete;
+
+    // reserves the next slot for host and returns when it is, the caller waits for it on a timer of its own
+    // so it can cut the wait short, the slot stays taken either way
+    boost::asio::awaitable<std::chrono::steady_clock::time_point> acquire(std::string host);
+
+private:
+    boost::asio::awaitable<std::chrono::steady_clock::time_point> reserve(std::string host);
+
+    boost::asio::strand<boost::asio::any_io_executor> _strand;
+
+    std::chrono::steady_clock::time_point _next_any{};
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> _next_host;
+
+    static constexpr auto GLOBAL_SPACING = std::chrono::milliseconds(20);
+    static constexpr auto HOST_SPACING = std::chrono::milliseconds(200);
+
+    // hosts whose slot has passed are dropped once the map grows past this
+    static constexpr size_t PRUNE_SIZE = 1024;
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "PositionalStorage.hpp"
+
+// windows is left out, a handle from the cache can only be bound to the completion port once
+#if defined(BOOST_ASIO_HAS_FILE) && !defined(_WIN32)
+
+// asynchronous file I/O through asio, backed by io_uring
+// every read and write is submitted to the kernel and the coroutine suspends until it completes,
+// so the disk thread keeps many operations in flight instead of blocking on one syscall at a time
+// handles come from the client wide cache like PositionalStorage's, and are only lent to asio for one operation
+class AsyncFileStorage: public PositionalStorage {
+public:
+    AsyncFileStorage(boost::asio::any_io_executor exec, FileHandleCache& handles, std::vector<StorageFile> files, AllocationMode allocation);
+
+protected:
+    boost::asio::awaitable<bool> write_at(size_t file_index, uint64_t file_offset, std::span<const unsigned char> data) override;
+    boost::asio::awaitable<bool> read_at(size_t file_index, uint64_t file_offset, std::span<unsigned char> out) override;
+    boost::asio::awaitable<bool> write_vectored_at(size_t file_index, uint64_t file_offset, std::span<const std::span<const unsigned char>> buffers) override;
+
+private:
+    boost::asio::any_io_executor _exec;
+};
+
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string_view>
+#include <cstddef>
+
+// vectorized helpers for the bencode parsers
+//
+// bencode can't be indexed up front the way json is: string payloads are raw bytes of a given length,
+// so whether a ':' or 'e' is structural depends on every length before it
+// what does vectorize is the scanning within a token, the digit runs of lengths and integers
+// most runs in torrents and tracker responses are a few digits long, so a whole parse comes out about even with the scalar loop,
+// see bencode_bench and BENCODE_SCAN_SCALAR
+
+// index of the first byte at or after pos that isn't an ascii digit, data.size() if there is none
+size_t scan_digits(std::string_view data, size_t pos);
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ranges>
+#include <utility>
+#include <iterator>
+#include <stdexcept>
+#include <cstdint>
+#include <string_view>
+
+// a flat alternative to BEncodeParser
+// every value becomes one token on a tape and dict keys go into a sorted index next to it,
+// so a whole torrent parses into two vectors instead of a node, map entry and key string per value
+// views point into the parser and the input, both have to outlive them
+
+enum class BEncodeKind: uint8_t { Int, String, List, Dict };
+
+struct BEncodeToken {
+    BEncodeKind kind;
+
+    // one past the last token of this value, skipping a container skips everything in it
+    uint32_t next;
+
+    // elements of a list, pairs of a dict
+    uint32_t count;
+
+    // dicts, first entry of this dict in the key index
+    uint32_t index;
+
+    // encoded bytes of the value in the input
+    uint64_t begin, end;
+
+    // ints hold the value, strings the offset of their payload
+    int64_t value;
+};
+
+class BEncodeTapeParser;
+class BEncodeListView;
+class BEncodeDictView;
+
+class BEncodeView {
+public:
+    BEncodeView() = default;
+    BEncodeView(const BEncodeTapeParser* tape, uint32_t token): _tape(tape), _token(token) {}
+
+    bool is_int() const { return kind() == BEncodeKind::Int; }
+    bool is_string() const { return kind() == BEncodeKind::String; }
+    bool is_list() const { return kind() == BEncodeKind::List; }
+    bool is_dict() const { return kind() == BEncodeKind::Dict; }
+
+    // throw std::runtime_error on a type mismatch
+    int64_t as_int() const;
+    std::string_view as_string() const;
+    BEncodeListView as_list() const;
+    BEncodeDictView as_dict() const;
+
+    // the value exactly as it was encoded, the info hash is the SHA-1 of raw() of the info dict
+    std::string_view raw() const;
+
+private:
+    friend class BEncodeListView;
+    friend class BEncodeDictView;
+
+    const BEncodeToken& token() const;
+    BEncodeKind kind() const { return token().kind; }
+
+    const BEncodeTapeParser* _tape = nullptr;
+    uint32_t _token{};
+};
+
+class BEncodeListView: public std::ranges::view_interface<BEncodeListView> {
+public:
+    class iterator {
+    public:
+        using value_type = BEncodeView;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::forward_iterator_tag;
+
+        iterator() = default;
+        iterator(const BEncodeTapeParser* tape, uint32_t token): _tape(tape), _token(token) {}
+
+        BEncodeView operator*() const { return { _tape, _token }; }
+        iterator& operator++();
+        iterator operator++(int) { auto copy = *this; ++*this; return copy; }
+
+        bool operator==(const iterator& other) const { return _token == other._token; }
+
+    private:
+        const BEncodeTapeParser* _tape = nullptr;
+        uint32_t _token{};
+    };
+
+    BEncodeListView() = default;
+    BEncodeListView(const BEncodeTapeParser* tape, uint32_t token);
+
+    iterator begin() const { return { _tape, _first }; }
+    iterator end() const { return { _tape, _last }; }
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+private:
+    const BEncodeTapeParser* _tape = nullptr;
+    uint32_t _first{}, _last{};
+    size_t _size{};
+};
+
+// entries come out in key order, lookups are a binary search over the key index
+class BEncodeDictView: public std::ranges::view_interface<BEncodeDictView> {
+public:
+    using value_type = std::pair<std::string_view, BEncodeView>;
+
+    class iterator {
+    public:
+        using value_type = BEncodeDictView::value_type;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::forward_iterator_tag;
+
+        iterator() = default;
+        iterator(const BEncodeTapeParser* tape, const uint32_t* entry): _tape(tape), _entry(entry) {}
+
+        value_type operator*() const;
+
+        // the pair is built on demand, -> hands out a pointer to a copy held by the iterator
+        const value_type* operator->() const { _current = **this; return &_current; }
+
+        iterator& operator++() { ++_entry; return *this; }
+        iterator operator++(int) { auto copy = *this; ++*this; return copy; }
+
+        bool operator==(const iterator& other) const { return _entry == other._entry; }
+
+    private:
+        const BEncodeTapeParser* _tape = nullptr;
+        const uint32_t* _entry = nullptr;
+        mutable value_type _current;
+    };
+
+    BEncodeDictView() = default;
+    BEncodeDictView(const BEncodeTapeParser* tape, uint32_t token);
+
+    iterator begin() const { return { _tape, _entries }; }
+    iterator end() const { return { _tape, _entries + _size }; }
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    iterator find(std::string_view key) const;
+    bool contains(std::string_view key) const { return find(key) != end(); }
+
+    // throws std::out_of_range like std::map::at
+    BEncodeView at(std::string_view key) const;
+
+private:
+    const BEncodeTapeParser* _tape = nullptr;
+    const uint32_t* _entries = nullptr;
+    size_t _size{};
+};
+
+class BEncodeTapeParser {
+public:
+    // the input is not copied, it must outlive the parser and every view
+    explicit BEncodeTapeParser(std::string_view input): _data(input) {}
+
+    BEncodeView parse();
+
+private:
+    friend class BEncodeView;
+    friend class BEncodeListView;
+    friend class BEncodeDictView;
+
+    int64_t parse_int(size_t& pos) const;
+    uint64_t parse_length(size_t& pos) const;
+    void close_dict(uint32_t token, size_t keys_begin);
+
+    std::string_view _data;
+
+    std::vector<BEncodeToken> _tokens;
+
+    // key token of every dict entry, grouped per dict and sorted by key
+    std::vector<uint32_t> _keys;
+
+    // key tokens of the dicts still open, moved to _keys once a dict closes
+    std::vector<uint32_t> _open_keys;
+};
@@ -0,0 +1,229 @@
+#pragma once
+
+#include "BEncode.hpp"
+
+#include <span>
+#include <array>
+#include <vector>
+#include <cassert>
+#include <charconv>
+#include <stdexcept>
+#include <algorithm>
+#include <type_traits>
+#include <initializer_list>
+
+#include <boost/asio/buffer.hpp>
+
+// streaming bencode writer, values go straight to a sink as they are written
+// nothing is allocated here, the sink decides where bytes end up:
+//
+//  BEncodeCounter      only counts, run an encode through it first to size a buffer exactly
+//  BEncodeSpanSink     a caller provided buffer, throws if it runs out
+//  BEncodeDynamicSink  any asio DynamicBuffer, v2 (dynamic_string_buffer, dynamic_vector_buffer) or v1 (beast::flat_buffer)
+//                      a v1 buffer owns its storage, so hold it by reference: BEncodeDynamicSink<beast::flat_buffer&>{ buf }
+//
+// dict keys have to be written in sorted order, checked with an assert in debug builds (so a key has to outlive the next one),
+// keys that are known up front can be checked at compile time with bencode_keys_sorted()
+
+// static_assert(bencode_keys_sorted({ "complete", "incomplete", "interval" }));
+consteval bool bencode_keys_sorted(std::initializer_list<std::string_view> keys) {
+    return std::ranges::adjacent_find(keys, std::ranges::greater_equal{}) == keys.end();
+}
+
+// encoded sizes, for sizing a buffer without running the writer
+constexpr size_t bencode_digits(uint64_t value) {
+    size_t digits = 1;
+    while (value >= 10) { value /= 10; ++digits; }
+    return digits;
+}
+
+constexpr size_t bencode_int_size(int64_t value) {
+    auto magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    return 2 + (value < 0) + bencode_digits(magnitude);
+}
+
+constexpr size_t bencode_string_size(size_t length) {
+    return bencode_digits(length) + 1 + length;
+}
+
+struct BEncodeCounter {
+    size_t size{};
+
+    void write(const char*, size_t n) { size += n; }
+};
+
+struct BEncodeSpanSink {
+    std::span<char> out;
+    size_t size{};
+
+    void write(const char* p, size_t n) {
+        if (n > out.size() - size) throw std::length_error("BEncode output buffer too small");
+        std::copy_n(p, n, out.data() + size);
+        size += n;
+    }
+};
+
+template <typename DynamicBuffer>
+struct BEncodeDynamicSink {
+    DynamicBuffer buffer;
+
+    void write(const char* p, size_t n) {
+        if constexpr (boost::asio::is_dynamic_buffer_v2<std::remove_reference_t<DynamicBuffer>>::value) {
+            auto offset = buffer.size();
+            buffer.grow(n);
+            boost::asio::buffer_copy(buffer.data(offset, n), boost::asio::buffer(p, n));
+        }
+        else {
+            buffer.commit(boost::asio::buffer_copy(buffer.prepare(n), boost::asio::buffer(p, n)));
+        }
+    }
+};
+
+template <typename Sink>
+class BEncodeWriter {
+public:
+    explicit BEncodeWriter(Sink sink): _sink(std::move(sink)) {}
+
+    void integer(int64_t value) {
+        value_written();
+
+        // a counting pass only needs the size, the digits aren't formatted
+        if constexpr (std::is_same_v<Sink, BEncodeCounter>) {
+            _sink.size += bencode_int_size(value);
+            return;
+        }
+
+        std::array<char, 24> buf;
+        buf[0] = 'i';
+        auto end = std::to_chars(buf.data() + 1, buf.data() + buf.size() - 1, value).ptr;
+        *end++ = 'e';
+
+        _sink.write(buf.data(), static_cast<size_t>(end - buf.data()));
+    }
+
+    void string(std::string_view value) {
+        value_written();
+        length_prefix(value.size());
+        _sink.write(value.data(), value.size());
+    }
+
+    void string(std::span<const unsigned char> value) {
+        string(std::string_view(reinterpret_cast<const char*>(value.data()), value.size()));
+    }
+
+    // a value that is already encoded, copied as is, an info dict written this way keeps its hash
+    void raw(std::string_view encoded) {
+        value_written();
+        _sink.write(encoded.data(), encoded.size());
+    }
+
+    void begin_list() { open('l', false); }
+    void begin_dict() { open('d', true); }
+
+    void end() {
+        assert(_depth > 0 && "end() without an open container");
+        assert((!_frames[_depth - 1].dict || !_frames[_depth - 1].want_value) && "dict key without a value");
+
+        --_depth;
+        _sink.write("e", 1);
+    }
+
+    void key(std::string_view name) {
+        assert(_depth > 0 && _frames[_depth - 1].dict && "key() outside of a dict");
+
+        auto& frame = _frames[_depth - 1];
+        assert(!frame.want_value && "two keys in a row");
+        assert((!frame.has_key || frame.last_key < name) && "dict keys out of order");
+
+        frame.last_key = name;
+        frame.has_key = true;
+        frame.want_value = true;
+
+        length_prefix(name.size());
+        _sink.write(name.data(), name.size());
+    }
+
+    // shorthands for the common key/value pairs
+    void entry(std::string_view name, int64_t value) { key(name); integer(value); }
+    void entry(std::string_view name, std::string_view value) { key(name); string(value); }
+    void entry(std::string_view name, const char* value) { key(name); string(std::string_view(value)); }
+
+    // encodes a parsed value, BEncodeValue dicts are std::map so they come out sorted like the input should have been
+    void value(const BEncodeValue& v) {
+        if (v.is_int()) integer(v.as_int());
+        else if (v.is_string()) string(v.as_string());
+        else if (v.is_list()) {
+            begin_list();
+            for (const auto& element: v.as_list()) value(element);
+            end();
+        }
+        else {
+            begin_dict();
+            for (const auto& [name, element]: v.as_dict()) {
+                key(name);
+                value(element);
+            }
+            end();
+        }
+    }
+
+    Sink& sink() { return _sink; }
+
+private:
+    void length_prefix(size_t length) {
+        if constexpr (std::is_same_v<Sink, BEncodeCounter>) {
+            _sink.size += bencode_digits(length) + 1;
+            return;
+        }
+
+        std::array<char, 24> buf;
+        auto end = std::to_chars(buf.data(), buf.data() + buf.size() - 1, length).ptr;
+        *end++ = ':';
+        _sink.write(buf.data(), static_cast<size_t>(end - buf.data()));
+    }
+
+    void open(char tag, bool dict) {
+        value_written();
+
+        if (_depth == MAX_DEPTH) throw std::length_error("BEncode nesting too deep");
+        _frames[_depth++] = { {}, dict, false, false };
+
+        _sink.write(&tag, 1);
+    }
+
+    // a value inside a dict has to follow its key
+    void value_written() {
+        if (_depth == 0) return;
+
+        auto& frame = _frames[_depth - 1];
+        assert((!frame.dict || frame.want_value) && "dict value without a key");
+        frame.want_value = false;
+    }
+
+    // fixed depth keeps the writer allocation free, nothing we encode comes close
+    static constexpr size_t MAX_DEPTH = 32;
+
+    struct Frame {
+        std::string_view last_key;
+        bool dict, has_key, want_value;
+    };
+
+    Sink _sink;
+    std::array<Frame, MAX_DEPTH> _frames{};
+    size_t _depth{};
+};
+
+// encodes twice, once to count and once into a buffer of exactly that size
+// fn is called with a BEncodeWriter and must write the same thing both times
+template <typename Fn>
+std::vector<char> bencode(Fn&& fn) {
+    BEncodeWriter counter{ BEncodeCounter{} };
+    fn(counter);
+
+    std::vector<char> out(counter.sink().size);
+
+    BEncodeWriter writer{ BEncodeSpanSink{ out } };
+    fn(writer);
+
+    return out;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "NativeFile.hpp"
+
+#include <filesystem>
+#include <vector>
+#include <span>
+#include <mutex>
+#include <cstdint>
+
+#include <boost/asio.hpp>
+
+// selectable per session, see make_storage()
+enum class StorageMode: uint8_t { Positional, Mmap, AsyncFile, Direct };
+
+// what happens to a file the first time it is opened for writing
+// sparse sets the final size, full reserves every block to avoid fragmentation, none lets the file grow as it is written
+enum class AllocationMode: uint8_t { Sparse, Full, None };
+
+// hint for backends that can make use of it (mmap readahead)
+enum class AccessPattern: uint8_t { Sequential, Random };
+
+struct StorageFile {
+    std::filesystem::path path;
+    uint64_t length, offset;
+
+    // padding between files, writes are dropped and reads are zeros, see TorrentFile::pad
+    bool pad = false;
+};
+
+// a storage backend only knows how to move bytes in and out of a list of files
+// offsets passed to write() and read() are offsets into the whole torrent, and are split across files here
+class BaseStorage {
+public:
+    BaseStorage(std::vector<StorageFile> files, AllocationMode allocation): _files(std::move(files)), _allocation(allocation), _allocated(_files.size()) {}
+    virtual ~BaseStorage() = default;
+
+    // false if any part of it couldn't be written, the backend prints why
+    boost::asio::awaitable<bool> write(uint64_t offset, std::span<const unsigned char> data);
+    boost::asio::awaitable<bool> read(uint64_t offset, std::span<unsigned char> out);
+
+    // one contiguous run of the torrent, gathered from several buffers
+    boost::asio::awaitable<bool> write_vectored(uint64_t offset, std::span<const std::span<const unsigned char>> buffers);
+
+    virtual void set_access_pattern(AccessPattern) {}
+
+    // make everything written so far durable, called before resume data claims it
+    virtual void sync() = 0;
+
+    const std::vector<StorageFile>& files() const { return _files; }
+
+    // zero length files are never written to, so they are only created when asked for
+    void create_empty_files();
+
+protected:
+    virtual boost::asio::awaitable<bool> write_at(size_t file_index, uint64_t file_offset, std::span<const unsigned char> data) = 0;
+    virtual boost::asio::awaitable<bool> read_at(size_t file_index, uint64_t file_offset, std::span<unsigned char> out) = 0;
+
+    // backends with a gather write override this, the default writes buffer by buffer
+    virtual boost::asio::awaitable<bool> write_vectored_at(size_t file_index, uint64_t file_offset, std::span<const std::span<const unsigned char>> buffers);
+
+    // index of the file containing the torrent offset
+    size_t file_index_for(uint64_t offset) const;
+
+    // files are created on first write, call before opening one with create set
+    void create_parent_directories(size_t file_index);
+
+    // applies the allocation mode, only the first call for each file does anything
+    void allocate(size_t file_index, native_handle_t handle);
+
+    std::vector<StorageFile> _files;
+
+private:
+    AllocationMode _allocation;
+    std::vector<uint8_t> _allocated;
+    std::mutex _allocate_mutex;
+};
@@ -21,6 +21,17 @@ struct TrackerResponse {
     std::vector<Peer> peers;
     std::optional<uint32_t> interval = std::nullopt;
     std::string error;
+
+    // earliest we may announce again when not waiting for interval, http trackers only
+    std::optional<uint32_t> min_interval = std::nullopt;
+};
+
+// values as sent in a BEP 15 announce
+enum class TrackerEvent: uint32_t { None = 0, Completed = 1, Started = 2, Stopped = 3 };
+
+// swarm size from a scrape, cheaper to ask for than a full announce
+struct ScrapeStats {
+    uint32_t seeders{}, completed{}, leechers{};
 };
 
 class BaseTracker {
@@ -36,7 +47,7 @@ public:
         _scheme = std::string(_url.scheme());
         _host   = std::string(_url.host());
 
-        if (_url.port().empty()) _port = (_scheme == "udp") ? 6969 : 443;
+        if (_url.port().empty()) _port = (_scheme == "udp") ? 6969 : (_scheme == "http") ? 80 : 443;
         else  _port = static_cast<uint16_t>(std::stoi(std::string(_url.port())));
     
         _path = std::string(_url.path());
@@ -44,12 +55,17 @@ public:
 
     virtual ~BaseTracker() = default;
 
-    virtual boost::asio::awaitable<TrackerResponse> async_announce(const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total) = 0;
+    virtual boost::asio::awaitable<TrackerResponse> async_announce(const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total, TrackerEvent event) = 0;
 
     const std::string_view url() const { return _raw_url; }
+    const std::string& host() const { return _host; }
 
     virtual void stop() = 0;
 
+    // last scrape of this torrent on this tracker, scrapes are batched across torrents by the client
+    const std::optional<ScrapeStats>& scrape_stats() const { return _scrape; }
+    void set_scrape_stats(std::optional<ScrapeStats> stats) { _scrape = stats; }
+
 protected:
     boost::asio::any_io_executor _exec;
 
@@ -62,4 +78,6 @@ protected:
 
     const std::array<unsigned char, 20>& _info_hash;
     const NetworkCapabilities& _nc;
+
+    std::optional<ScrapeStats> _scrape;
 };
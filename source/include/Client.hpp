@@ -3,6 +3,12 @@
 #include "server.hpp"
 #include "TorrentSession.hpp"
 #include "NetworkCapabilities.hpp"
+#include "UdpTrackerMux.hpp"
+#include "UdpTracker.hpp"
+#include "DnsCache.hpp"
+#include "HttpConnectionPool.hpp"
+#include "AnnounceScheduler.hpp"
+#include "TorrentCreator.hpp"
 
 #include <filesystem>
 #include <string>
@@ -28,24 +34,69 @@ class Client {
 public:
     Client();
     void run();
-    AddTorrentResult add_torrent(const std::vector<char>& data);
+    AddTorrentResult add_torrent(std::vector<char> data, StorageMode storage_mode = StorageMode::Positional, AllocationMode allocation = AllocationMode::Sparse);
+
+    // already parsed, e.g. from Metadata::map_file() when loading .torrent files from disk
+    AddTorrentResult add_torrent(Metadata&& md, StorageMode storage_mode = StorageMode::Positional, AllocationMode allocation = AllocationMode::Sparse);
     boost::asio::awaitable<void> remove_if_exists(const std::string& hash, bool remove_files);
 
     // ui state
     std::vector<TorrentSnapshot> get_torrent_snapshots() const;
     std::vector<PeerSnapshot> get_peer_snapshots(const std::string& hash) const;
     std::vector<TrackerSnapshot> get_tracker_snapshots(const std::string& hash) const;
+    std::vector<DiskDeviceStats> get_disk_device_stats() const;
+
+    // for the api, one torrent is hashed at a time and a few more may wait, past that this throws
+    boost::asio::awaitable<CreatedTorrent> create_torrent(CreateTorrentOptions options);
 
 private:
     // for sessions
     boost::asio::io_context _ioc;
-    boost::asio::thread_pool _disk_pool{1};
+    // positional file I/O makes the disk pool safe to run on several threads
+    const size_t _disk_threads = disk_thread_count();
+    boost::asio::thread_pool _disk_pool{ _disk_threads };
+    static size_t disk_thread_count();
+
+    // orders and shares out the disk jobs of every torrent, one job per disk thread in flight on each device
+    DiskScheduler _disk_scheduler{ _disk_threads };
+
+    // open files of every torrent, bounded so descriptor use stays flat however many torrents are seeding
+    FileHandleCache _file_handles;
+
+    // tracker host lookups, shared so a tracker used by many torrents is resolved once
+    DnsCache _dns{ _ioc.get_executor(), nc };
+
+    // udp tracker sockets and connection ids shared by every torrent, has to outlive the sessions
+    // nc is only read once the client runs, so it being declared further down is fine
+    // three tries (15 + 30 + 60 seconds) before a udp tracker counts as down, rather than the hours BEP 15 allows
+    UdpTrackerMux _udp_trackers{ _ioc.get_executor(), nc, UdpRetryPolicy{ .max_retries = 2 } };
+
+    // keep-alive https tracker connections, hundreds of torrents on one private tracker share a few of them
+    HttpConnectionPool _http_trackers{ _ioc.get_executor(), _dns };
+
+    // paces announces across every session
+    AnnounceScheduler _announce_scheduler{ _ioc.get_executor() };
+
+    // torrent creation, declared after _ioc so it is joined before the context it posts results to goes away
+    boost::asio::thread_pool _create_pool{ 1 };
+    size_t _pending_creates{};
+    static constexpr size_t MAX_PENDING_CREATES = 4;
 
     std::unordered_map<std::string, std::unique_ptr<TorrentSession>> _sessions;
     void detect_network_capabilities();
     bool can_bind_ipv6();
     void start_acceptors();
 
+    // udp trackers are scraped for every torrent together, one request per MAX_SCRAPE_HASHES torrents
+    // much less often than announces, it only has to be fresh enough to pick which torrents to run
+    static constexpr auto SCRAPE_DELAY = std::chrono::minutes(1);
+    static constexpr auto SCRAPE_INTERVAL = std::chrono::minutes(30);
+    boost::asio::steady_timer _scrape_timer{ _ioc };
+    boost::asio::awaitable<void> scrape_loop();
+    void scrape_udp_trackers();
+    // one tracker per url that only sends scrapes, a session stopping its own tracker can't abort the batch
+    std::unordered_map<std::string, std::shared_ptr<UdpTracker>> _scrapers;
+
     boost::asio::awaitable<void> accept_loop_v4();
     boost::asio::awaitable<void> accept_loop_v6();
     boost::asio::awaitable<void> handle_inbound(boost::asio::ip::tcp::socket socket, boost::asio::ip::tcp::endpoint ep);
@@ -60,6 +111,10 @@ private:
     // helpers
     std::string compute_doc_root() const;
     std::filesystem::path get_exe_dir() const;
+
+    // the only tree the api may create torrents from, and where it writes them
+    // CTORRENT_SHARE_ROOT if set, otherwise the directory torrents are downloaded to
+    std::filesystem::path compute_share_root() const;
     NetworkCapabilities nc;
     uint16_t listen_port = 6881;
 };
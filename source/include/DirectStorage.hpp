@@ -0,0 +1,30 @@
+#pragma once
+
+#include "PositionalStorage.hpp"
+#include "AlignedBufferPool.hpp"
+
+#include <array>
+
+// positional storage with the page cache bypassed, O_DIRECT on linux and FILE_FLAG_NO_BUFFERING on windows
+// the kernel wants aligned offsets, lengths and addresses, so everything is staged through aligned bounce buffers
+// and the partial blocks at either end of a write are read back and merged in first
+class DirectStorage: public PositionalStorage {
+public:
+    DirectStorage(FileHandleCache& handles, std::vector<StorageFile> files, AllocationMode allocation);
+
+protected:
+    boost::asio::awaitable<bool> write_at(size_t file_index, uint64_t file_offset, std::span<const unsigned char> data) override;
+    boost::asio::awaitable<bool> read_at(size_t file_index, uint64_t file_offset, std::span<unsigned char> out) override;
+    boost::asio::awaitable<bool> write_vectored_at(size_t file_index, uint64_t file_offset, std::span<const std::span<const unsigned char>> buffers) override;
+
+private:
+    bool write_direct(size_t file_index, native_handle_t handle, uint64_t file_offset, std::span<const std::span<const unsigned char>> buffers);
+
+    // two writes meeting in the middle of a block both rewrite it, whichever goes second has to see the first
+    std::mutex& edge_lock(size_t file_index) { return _edge_locks[file_index % _edge_locks.size()]; }
+    std::array<std::mutex, 64> _edge_locks;
+
+    // one piece per buffer for the usual piece sizes, bigger writes go through in several rounds
+    static constexpr size_t BUFFER_SIZE = 4 * 1024 * 1024;
+    AlignedBufferPool _buffers{ BUFFER_SIZE, DIRECT_IO_ALIGNMENT, 16 };
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <unordered_map>
+#include <chrono>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <cstdint>
+
+#include <boost/asio.hpp>
+
+enum class DiskJobKind: uint8_t { Read, Write };
+
+// offset is into the torrent, files of a torrent are laid out in offset order so it stands in for (file, offset)
+struct DiskJob {
+    uint32_t client;
+    DiskJobKind kind;
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+// one per client, every disk job of every torrent waits here for its turn
+// jobs are queued per device and handed out in (torrent, offset) order, sweeping up like an elevator
+// a read for an upload waiting past READ_LATENCY_BOUND, or any job past DEADLINE, jumps the sweep
+// and a torrent that was served more than FAIR_QUANTUM bytes ahead of the others sits out until they catch up
+struct DiskDeviceStats {
+    uint64_t device;
+    size_t queued, in_flight;
+};
+
+class DiskScheduler {
+public:
+    explicit DiskScheduler(size_t jobs_per_device): _jobs_per_device(jobs_per_device) {}
+
+    DiskScheduler(const DiskScheduler&) = delete;
+    DiskScheduler& operator=(const DiskScheduler&) = delete;
+
+    // torrents saving to the same device share one queue
+    uint32_t add_client(const std::filesystem::path& root);
+
+    // only for a client with nothing queued or running, anything still queued is rejected and jobs in flight still have to be released
+    void remove_client(uint32_t client);
+
+    // resumes on the caller's executor once the job may run, release() has to follow when it's done
+    // throws for a client that has been removed
+    boost::asio::awaitable<void> acquire(DiskJob job);
+    void release(const DiskJob& job);
+
+    size_t pending(uint32_t client) const;
+    std::vector<DiskDeviceStats> device_stats() const;
+
+private:
+    static constexpr auto READ_LATENCY_BOUND = std::chrono::milliseconds(100);
+    static constexpr auto DEADLINE = std::chrono::milliseconds(1000);
+    static constexpr uint64_t FAIR_QUANTUM = 4ull * 1024 * 1024;
+
+    struct Pending {
+        DiskJobKind kind;
+        uint64_t bytes;
+        std::chrono::steady_clock::time_point queued;
+        // called with false when the job is turned away instead of run
+        std::move_only_function<void(bool)> wake;
+    };
+
+    // (client, offset), the order of the sweep
+    using Position = std::pair<uint32_t, uint64_t>;
+
+    struct Device {
+        std::multimap<Position, Pending> queue;
+        Position head{};
+        size_t in_flight{};
+    };
+
+    struct ClientState {
+        uint64_t device;
+        uint64_t served{};
+        size_t pending{}, in_flight{};
+
+        // kept until its last job in flight is released, so that job's slot is given back to the device
+        bool removed = false;
+    };
+
+    static uint64_t device_id(const std::filesystem::path& root);
+
+    void enqueue(const DiskJob& job, std::move_only_function<void(bool)> wake);
+    void dispatch(Device& device, std::vector<std::move_only_function<void(bool)>>& ready);
+    std::multimap<Position, Pending>::iterator pick(Device& device);
+    uint64_t served(uint32_t client) const;
+
+    size_t _jobs_per_device;
+    uint32_t _next_client{};
+
+    std::unordered_map<uint64_t, Device> _devices;
+    std::unordered_map<uint32_t, ClientState> _clients;
+    mutable std::mutex _mutex;
+};
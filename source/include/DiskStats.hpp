@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+struct LatencySnapshot {
+    uint64_t count{}, mean_us{}, p50_us{}, p99_us{}, max_us{};
+
+    // bucket i counts samples below 2^i microseconds that didn't fit the bucket before it
+    std::vector<uint64_t> buckets;
+};
+
+// power of two buckets in microseconds, recording is a few relaxed atomic adds and safe from any thread
+class LatencyHistogram {
+public:
+    static constexpr size_t BUCKETS = 32;
+
+    void record(std::chrono::steady_clock::duration elapsed);
+    LatencySnapshot snapshot() const;
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> _buckets{};
+    std::atomic<uint64_t> _count{}, _total_us{}, _max_us{};
+};
+
+// times a scope into a histogram
+class ScopedLatency {
+public:
+    explicit ScopedLatency(LatencyHistogram& histogram): _histogram(histogram), _start(std::chrono::steady_clock::now()) {}
+    ~ScopedLatency() { _histogram.record(std::chrono::steady_clock::now() - _start); }
+
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+private:
+    LatencyHistogram& _histogram;
+    std::chrono::steady_clock::time_point _start;
+};
+
+struct DiskStatsSnapshot {
+    LatencySnapshot read, write, hash, queue_wait;
+    uint64_t bytes_read{}, bytes_written{};
+
+    // filled in by the session from two snapshots
+    uint64_t read_rate{}, write_rate{};
+
+    // jobs of this torrent waiting for the disk scheduler
+    size_t pending{};
+};
+
+// per torrent, read covers read_block end to end, write each storage write the write cache issues,
+// hash the piece hash check and queue_wait the time a job spends waiting for its turn at the scheduler
+struct DiskStats {
+    LatencyHistogram read, write, hash, queue_wait;
+    std::atomic<uint64_t> bytes_read{}, bytes_written{};
+
+    DiskStatsSnapshot snapshot() const;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <boost/asio.hpp>
+
+struct NetworkCapabilities;
+
+// addresses of one host, kept apart by family so a tracker can pick the one it announces over
+struct DnsEntry {
+    std::vector<boost::asio::ip::address> v4, v6;
+    boost::system::error_code ec;
+    std::chrono::steady_clock::time_point expires;
+};
+
+// one lookup per host for every tracker of every torrent
+// answers are kept for a while, failures too so a dead host isn't asked for on every announce,
+// and callers asking for a host that is being looked up already wait for that lookup instead of starting their own
+class DnsCache {
+public:
+    DnsCache(boost::asio::any_io_executor exec, const NetworkCapabilities& nc);
+
+    DnsCache(const DnsCache&) = delete;
+    DnsCache& operator=(const DnsCache&) = delete;
+
+    // only the families NetworkCapabilities says we can reach are looked up, an ip literal never is
+    boost::asio::awaitable<std::shared_ptr<const DnsEntry>> lookup(std::string host);
+
+private:
+    boost::asio::awaitable<std::shared_ptr<const DnsEntry>> do_lookup(std::string host);
+    boost::asio::awaitable<std::vector<boost::asio::ip::address>> resolve(const std::string& host, boost::asio::ip::tcp protocol, boost::system::error_code& ec);
+
+    boost::asio::strand<boost::asio::any_io_executor> _strand;
+    const NetworkCapabilities& _nc;
+
+    struct Slot {
+        std::shared_ptr<const DnsEntry> entry;
+
+        // set while a lookup is in flight, cancelled when it finishes
+        std::shared_ptr<boost::asio::steady_timer> resolving;
+    };
+    std::unordered_map<std::string, Slot> _cache;
+
+    // getaddrinfo doesn't pass on record ttls, so these stand in for them
+    static constexpr auto POSITIVE_TTL = std::chrono::minutes(10);
+    static constexpr auto NEGATIVE_TTL = std::chrono::minutes(1);
+
+    // expired entries are dropped once the cache grows past this
+    static constexpr size_t PRUNE_SIZE = 1024;
+};
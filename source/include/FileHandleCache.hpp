@@ -0,0 +1,54 @@
+#pragma once
+
+#include "NativeFile.hpp"
+
+#include <filesystem>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <list>
+
+// an open file, closed once it has been evicted and nobody is using it anymore
+struct FileHandle {
+    native_handle_t handle;
+    bool writable, direct;
+
+    FileHandle(native_handle_t h, bool w, bool d): handle(h), writable(w), direct(d) {}
+    ~FileHandle() { close_native(handle); }
+
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+};
+
+// one per client, shared by the storage of every torrent
+// keeps at most capacity files open and closes the least recently used one to make room,
+// so thousands of seeding torrents don't run the process out of descriptors
+class FileHandleCache {
+public:
+    explicit FileHandleCache(size_t capacity = default_capacity()): _capacity(capacity) {}
+
+    // files are opened read-only unless write is set, a read-only handle is reopened on the first write
+    // and a handle is reopened when asked for with a different direct setting than it was opened with
+    // nullptr if the file can't be opened, reads don't create missing files
+    std::shared_ptr<FileHandle> open(const std::filesystem::path& path, bool write, bool direct = false);
+
+    // drop the handle for path, for when a torrent goes away and its files may be deleted
+    void close(const std::filesystem::path& path);
+
+    size_t size() const;
+
+private:
+    static size_t default_capacity();
+
+    struct Entry {
+        std::shared_ptr<FileHandle> file;
+        std::list<std::filesystem::path::string_type>::iterator lru;
+    };
+
+    size_t _capacity;
+
+    // front is the most recently used
+    std::list<std::filesystem::path::string_type> _lru;
+    std::unordered_map<std::filesystem::path::string_type, Entry> _entries;
+    mutable std::mutex _mutex;
+};
@@ -1,38 +1,154 @@
 #pragma once
 
+#include "BaseStorage.hpp"
+#include "FileHandleCache.hpp"
+#include "DiskScheduler.hpp"
+#include "DiskStats.hpp"
+#include "ResumeData.hpp"
+
 #include <filesystem>
 #include <print>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <atomic>
+#include <chrono>
 
 #include <boost/asio.hpp>
 
 // ALL CALLS TO FILEMANAGER MUST GO THROUGH THE DISK EXECUTOR ONLY
+// the disk executor may have several threads, storage backends are positional and resume state is locked
 
 struct TorrentFile;
 
+// verified pieces are held back and written out in offset order, adjacent pieces merged into one write
+struct WriteCacheConfig {
+    uint64_t budget_bytes = 64ull * 1024 * 1024;
+    std::chrono::milliseconds flush_deadline{ 5000 };
+};
+
+// what load_resume() found on disk
+struct ResumeState {
+    std::vector<uint32_t> completed;
+    std::vector<ResumePartialPiece> partial;
+    // claimed complete in a file that changed since, hashed again before they count
+    std::vector<uint32_t> recheck;
+};
+
+// an unfinished piece at a save point, blocks holds every received block
+// unwritten only the ones that haven't been written in place by an earlier save
+struct PartialPieceWrite {
+    uint32_t piece;
+    std::vector<uint8_t> blocks;
+    std::vector<std::pair<uint32_t, std::vector<unsigned char>>> unwritten;
+};
+
 class FileManager {
 public:
 
-    FileManager(std::filesystem::path root, std::string_view torrent_name, std::vector<TorrentFile>& file_list, uint64_t total_size, uint64_t piece_length): standard_piece_length(piece_length) {           
-        build_output_files(root, torrent_name, file_list, total_size);
+    FileManager(boost::asio::any_io_executor disk_exec, FileHandleCache& handles, DiskScheduler& scheduler, std::filesystem::path root, std::string_view torrent_name, std::vector<TorrentFile>& file_list, uint64_t total_size, uint64_t piece_length, StorageMode mode = StorageMode::Positional, AllocationMode allocation = AllocationMode::Sparse, WriteCacheConfig cache_config = {}): 
+        _disk_exec(disk_exec), _scheduler(scheduler), _disk_client(scheduler.add_client(root)), _cache_config(cache_config), _flush_strand(boost::asio::make_strand(disk_exec)), _flush_timer(_flush_strand), _flush_done(_flush_strand, boost::asio::steady_timer::time_point::max()), standard_piece_length(piece_length) {           
+        build_output_files(disk_exec, handles, root, torrent_name, file_list, total_size, mode, allocation);
     }
 
+    ~FileManager() { _scheduler.remove_client(_disk_client); }
+
     boost::asio::awaitable<void> write_piece(uint32_t piece, std::vector<unsigned char> data);
     boost::asio::awaitable<std::optional<std::vector<unsigned char>>> read_block(uint32_t piece, uint32_t begin, uint32_t length);
-    std::vector<uint32_t> read_save_file();
+
+    // completed and partial pieces from the resume file, pieces in files that changed on disk since are handed back for a recheck
+    // stats every file, keep it on the disk executor like everything else here
+    ResumeState load_resume();
+
+    // a piece already on disk passed its recheck, call on the disk executor
+    void confirm_piece(uint32_t piece) { mark_complete(piece); }
+
+    // commit the completed set if anything changed since the last commit
+    boost::asio::awaitable<void> save_resume();
+
+    // write received blocks of unfinished pieces in place and commit them with the completed set
+    boost::asio::awaitable<void> save_partial(std::vector<PartialPieceWrite> pieces);
+
+    // write out everything in the write cache
+    boost::asio::awaitable<void> flush();
+
+    // the last flush, no deadline flush is left running or scheduled afterwards, call before the session goes away
+    boost::asio::awaitable<void> close();
+
+    // safe to call from any thread, the piece picker stops starting new pieces while this is true
+    bool write_cache_full() const { return _cached_bytes.load(std::memory_order_relaxed) >= _cache_config.budget_bytes; }
+
+    void set_access_pattern(AccessPattern pattern) { _storage->set_access_pattern(pattern); }
+
+    // safe to use from any thread, the piece manager records its hash checks here too
+    DiskStats& stats() { return _stats; }
+    const DiskStats& stats() const { return _stats; }
+
+    // jobs of this torrent waiting at the scheduler
+    size_t disk_pending() const { return _scheduler.pending(_disk_client); }
 
 private:
 
-    struct OutputFile {
-        std::fstream handle;
-        uint64_t length, offset;
+    boost::asio::any_io_executor _disk_exec;
+
+    // every read and write that reaches the storage takes a turn from the client wide scheduler first
+    DiskScheduler& _scheduler;
+    uint32_t _disk_client;
+    boost::asio::awaitable<void> acquire_disk(const DiskJob& job);
+
+    DiskStats _stats;
+
+    struct CachedPiece {
+        uint32_t piece;
+        std::vector<unsigned char> data;
     };
 
-    std::vector<OutputFile> output_files;
+    // keyed by torrent offset, so runs of adjacent pieces come out in order
+    std::map<uint64_t, CachedPiece> _cache;
+    // taken out of the cache by a flush that is still writing them, reads must still see them
+    std::map<uint64_t, CachedPiece> _flushing;
+    std::mutex _cache_mutex;
+
+    std::atomic<uint64_t> _cached_bytes{};
+    WriteCacheConfig _cache_config;
 
-    void build_output_files(std::filesystem::path root, std::string_view torrent_name, std::vector<TorrentFile>& file_list, uint64_t total_size);
+    // flush_after_deadline() and close() meet on the strand, the two timers are only touched from it
+    boost::asio::strand<boost::asio::any_io_executor> _flush_strand;
+    boost::asio::steady_timer _flush_timer;
+    // cancelled when a flush_after_deadline() returns
+    boost::asio::steady_timer _flush_done;
+
+    // true while a flush_after_deadline() is alive, only ever set together with spawning one
+    bool _flush_scheduled = false;
+    bool _closing = false;
+    void schedule_flush();
+    boost::asio::awaitable<void> flush_after_deadline();
+
+    std::optional<std::vector<unsigned char>> read_from_cache(uint32_t piece, uint32_t begin, uint32_t length);
+
+    std::unique_ptr<BaseStorage> _storage;
+
+    void build_output_files(boost::asio::any_io_executor disk_exec, FileHandleCache& handles, std::filesystem::path root, std::string_view torrent_name, std::vector<TorrentFile>& file_list, uint64_t total_size, StorageMode mode, AllocationMode allocation);
     void mark_complete(uint32_t piece);
+    void write_resume();
 
     uint64_t standard_piece_length;
-    std::fstream savefile;
-};
\ No newline at end of file
+    uint64_t _total_size{};
+    uint32_t _num_pieces{};
+
+    // completed pieces, committed to disk every SAVE_EVERY completions and on a timer from the session
+    std::filesystem::path _resume_path;
+    std::vector<uint8_t> _completed;
+    uint32_t _completed_count{};
+    bool _empty_files_created = false;
+    std::map<uint32_t, std::vector<uint8_t>> _partial;
+
+    // blocks of unfinished pieces whose last write failed, kept out of _partial until one succeeds
+    std::map<uint32_t, std::vector<uint8_t>> _unpersisted;
+    static constexpr uint32_t PARTIAL_BLOCK_SIZE = 16384;
+    size_t _unsaved_completions{};
+    std::mutex _resume_mutex;
+    std::mutex _save_mutex;
+    static constexpr size_t SAVE_EVERY = 64;
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast.hpp>
+
+class DnsCache;
+
+// keep-alive http and https connections shared by every tracker of every torrent, pooled per scheme, host and port
+// one ssl context for all of them, and the last tls session of each host is offered again so a new connection
+// to a tracker we already talked to resumes instead of doing a full handshake
+class HttpConnectionPool {
+public:
+    using tcp = boost::asio::ip::tcp;
+    using TlsStream = boost::asio::ssl::stream<tcp::socket>;
+    using Request = boost::beast::http::request<boost::beast::http::string_body>;
+    using Response = boost::beast::http::response<boost::beast::http::dynamic_body>;
+
+    struct Result {
+        boost::system::error_code ec;
+        Response response;
+    };
+
+    HttpConnectionPool(boost::asio::any_io_executor exec, DnsCache& dns);
+    ~HttpConnectionPool();
+
+    HttpConnectionPool(const HttpConnectionPool&) = delete;
+    HttpConnectionPool& operator=(const HttpConnectionPool&) = delete;
+
+    // sends request on an idle connection to host when there is one, a new one otherwise, over tls when asked to
+    // a reused connection the server has closed in the meantime is retried once on a fresh one
+    boost::asio::awaitable<Result> request(bool tls, std::string host, uint16_t port, Request request, const void* owner);
+
+    // closes the connections owner is using right now, a stopping tracker should not wait for a slow server
+    void cancel(const void* owner);
+
+private:
+    struct Connection {
+        std::string key;
+
+        // one or the other, depending on the scheme
+        std::unique_ptr<TlsStream> tls;
+        std::unique_ptr<tcp::socket> plain;
+
+        tcp::socket& socket() { return tls ? tls->next_layer() : *plain; }
+
+        // a keep-alive connection can have bytes of the next response buffered already
+        boost::beast::flat_buffer buffer;
+        std::chrono::steady_clock::time_point last_used;
+
+        // the last exchange went through, its tls session is worth resuming
+        bool healthy = false;
+
+        ~Connection();
+    };
+
+    boost::asio::awaitable<std::unique_ptr<Connection>> connect(bool tls, const std::string& key, const std::string& host, uint16_t port, const void* owner, boost::system::error_code& ec);
+    std::unique_ptr<Connection> take_idle(const std::string& key);
+
+    // connections in use, so cancel() can find them
+    void set_active(const void* owner, Connection* conn, bool active);
+    void release(std::unique_ptr<Connection> conn);
+
+    // remembers the session of a finished exchange, tls 1.3 tickets only arrive after the handshake
+    void save_session(const std::string& key, TlsStream& stream);
+
+    boost::asio::awaitable<void> sweep_loop();
+
+    boost::asio::any_io_executor _exec;
+    DnsCache& _dns;
+    boost::asio::ssl::context _ssl_ctx;
+
+    std::mutex _mutex;
+    std::unordered_map<std::string, std::vector<std::unique_ptr<Connection>>> _idle;
+    std::unordered_map<std::string, SSL_SESSION*> _sessions;
+    std::multimap<const void*, Connection*> _active;
+
+    boost::asio::steady_timer _sweep_timer;
+    bool _sweeping = false;
+
+    // servers drop idle keep-alive connections after a minute or so anyway
+    static constexpr auto IDLE_TIMEOUT = std::chrono::seconds(60);
+    static constexpr size_t MAX_IDLE_PER_HOST = 4;
+};
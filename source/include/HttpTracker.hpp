@@ -2,6 +2,8 @@
 
 #include "BaseTracker.hpp"
 #include "NetworkCapabilities.hpp"
+#include "BEncodeTape.hpp"
+#include "HttpConnectionPool.hpp"
 
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
@@ -13,9 +15,10 @@ namespace ssl = boost::asio::ssl;
 namespace http = boost::beast::http;
 using tcp = net::ip::tcp;
 
-class HttpsTracker : public BaseTracker {
+// http and https trackers alike, the pool decides whether there is a tls layer from the scheme
+class HttpTracker : public BaseTracker {
 public:    
-    HttpsTracker(boost::asio::any_io_executor exec, std::string_view tracker_url, const std::array<unsigned char, 20>& info_hash, const NetworkCapabilities& nc): BaseTracker(exec, tracker_url, info_hash, nc), _ssl_ctx(boost::asio::ssl::context::tlsv12_client) {
+    HttpTracker(boost::asio::any_io_executor exec, std::string_view tracker_url, const std::array<unsigned char, 20>& info_hash, const NetworkCapabilities& nc, HttpConnectionPool& pool): BaseTracker(exec, tracker_url, info_hash, nc), _pool(pool) {
         _encoded_info_hash.reserve(_info_hash.size() * 3);
 
         for (unsigned char b: _info_hash) {
@@ -37,18 +40,17 @@ public:
         }
     }
 
-    ~HttpsTracker() = default;
+    ~HttpTracker() = default;
 
-    boost::asio::awaitable<TrackerResponse> async_announce(const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total) override; 
+    boost::asio::awaitable<TrackerResponse> async_announce(const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total, TrackerEvent event) override; 
 
-    boost::urls::url build_announce(const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total);
+    boost::urls::url build_announce(const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total, TrackerEvent event);
 
     void stop() override;
 
 private:
-    boost::asio::ssl::context _ssl_ctx;
-    std::optional<tcp::resolver> _resolver;
-    std::optional<ssl::stream<tcp::socket>> _stream;
+    // connections and tls sessions are shared with every other http tracker
+    HttpConnectionPool& _pool;
     bool stopped = false;
 
     TrackerResponse parse_peers(const std::string& body);
@@ -56,6 +58,6 @@ private:
 
     std::string ipv6_raw;
 
-    void parse_v4(TrackerResponse& out, const BEncodeValue& peers_entry);
-    void parse_v6(TrackerResponse& out, const BEncodeValue& peers_entry);
+    void parse_v4(TrackerResponse& out, const BEncodeView& peers_entry);
+    void parse_v6(TrackerResponse& out, const BEncodeView& peers_entry);
 };
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <vector>
+#include <optional>
+#include <cstdint>
+
+// BEP 52 hash trees: SHA-256 over 16 KiB blocks, leaves past the end of a file are all zero
+// a layer is padded to a power of two with the zero subtree of its height
+
+using Sha256 = std::array<unsigned char, 32>;
+
+constexpr size_t MERKLE_BLOCK_SIZE = 16384;
+
+// what a v2 piece has to hash to
+struct PieceRoot {
+    // 32 bytes in the metadata, a piece layer entry, or the pieces root of a file no bigger than a piece
+    std::span<const unsigned char> hash;
+
+    // the file's pieces root, names the tree in hash requests
+    std::span<const unsigned char> file_root;
+
+    // first block of the piece in its file, and the number of leaves under hash (a power of two)
+    uint32_t first_block, width;
+
+    // bytes of the file in this piece, anything after that is padding and isn't hashed
+    uint32_t length;
+};
+
+Sha256 sha256(std::span<const unsigned char> data);
+Sha256 merkle_parent(const Sha256& left, const Sha256& right);
+
+// root of an all-zero subtree of the given height, height 0 is a zero leaf
+const Sha256& merkle_pad(uint32_t height);
+
+// root over leaves, padded to width with subtrees of pad_height
+Sha256 merkle_root(std::span<const Sha256> leaves, size_t width, uint32_t pad_height = 0);
+
+// answers a hash request from a layer we have: the requested range followed by up to proof_layers uncle hashes,
+// bottom up, excluding the root. nullopt if the range isn't a valid request
+std::optional<std::vector<Sha256>> merkle_hashes_with_proof(std::span<const Sha256> layer, uint32_t layer_height, uint32_t index, uint32_t length, uint32_t proof_layers);
+
+constexpr uint32_t merkle_width(uint64_t leaves) {
+    uint32_t width = 1;
+    while (width < leaves) width <<= 1;
+    return width;
+}
+
+constexpr uint32_t merkle_height(uint64_t width) {
+    uint32_t height{};
+    while ((uint64_t{1} << height) < width) ++height;
+    return height;
+}
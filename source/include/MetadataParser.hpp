@@ -1,30 +1,70 @@
 #pragma once
 
-#include "Bencode.hpp"
+#include "BEncodeTape.hpp"
+#include "MerkleTree.hpp"
 
 #include <string>
 #include <optional>
 #include <array>
+#include <span>
+#include <memory>
+#include <vector>
 #include <ranges>
+#include <filesystem>
 
 #include <openssl/sha.h>
 
 struct TorrentFile {
 	std::string path;
 	uint64_t length;
+
+	// alignment between files (BEP 47 attr "p", or implied by a v2 layout), holds zeros and never hits the disk
+	bool pad = false;
+};
+
+// v1 has only "pieces", v2 only the "file tree", a hybrid has both describing the same pieces
+enum class TorrentVersion: uint8_t { V1, V2, Hybrid };
+
+// a file from the v2 file tree, the spans point into the metadata
+struct TorrentFileV2 {
+    std::string path;
+    uint64_t length;
+
+    // 32 bytes, empty for an empty file
+    std::span<const unsigned char> pieces_root;
+
+    // 32 bytes per piece, empty when the file fits in one piece (the root is the piece hash then)
+    std::span<const unsigned char> piece_layer;
+};
+
+// the bytes a Metadata was parsed from, every string_view and span in it points in here
+// sources are heap allocated so moving a Metadata never moves the bytes
+class MetadataSource {
+public:
+    virtual ~MetadataSource() = default;
+    virtual std::string_view bytes() const = 0;
 };
 
 struct Metadata {
-    Metadata(const std::vector<char>& data): in(data.begin(), data.end()) {
-        parse_torrent();
-        compute_info_hash_hex();
-    }
+    // takes ownership of the file contents, move the buffer in to avoid a copy
+    explicit Metadata(std::vector<char> data);
+
+    // maps the .torrent read only, only pages that are touched use memory, throws if it can't be opened
+    static Metadata map_file(const std::filesystem::path& path);
+
+    // parses a buffer owned elsewhere (an arena, a mapping), it has to outlive the Metadata
+    static Metadata borrow(std::string_view data);
 
     std::string_view announce;
     std::vector<std::vector<std::string_view>> announce_list;
     std::string_view name;
     uint64_t piece_length = 0;
-    std::vector<std::array<unsigned char, 20>> piece_hashes;
+
+    // the raw pieces string, 20 bytes of SHA-1 per piece
+    std::span<const unsigned char> piece_hashes;
+
+    size_t num_pieces() const { return version == TorrentVersion::V1 ? piece_hashes.size() / 20 : piece_roots.size(); }
+    std::span<const unsigned char, 20> piece_hash(size_t piece) const { return piece_hashes.subspan(piece * 20).first<20>(); }
 
     std::vector<TorrentFile> files;
     uint64_t total_size = 0;
@@ -33,15 +73,26 @@ struct Metadata {
     std::optional<std::string_view> created_by;
     uint64_t creation_date = 0;
 
+    // the hash used on the wire and with trackers, a pure v2 torrent uses its SHA-256 cut to 20 bytes
     std::array<unsigned char, 20> info_hash{};
 
+    TorrentVersion version = TorrentVersion::V1;
+    std::array<unsigned char, 32> info_hash_v2{};
+
+    std::vector<TorrentFileV2> v2_files;
+
+    // what each piece hashes to in its file's tree, empty for v1
+    std::vector<PieceRoot> piece_roots;
+
     std::string info_hash_hex;
 
 private:
+    explicit Metadata(std::unique_ptr<MetadataSource> source);
 
-    std::string in;
+    std::unique_ptr<MetadataSource> _source;
 
     void parse_torrent();
+    void parse_v2(const BEncodeDictView& root, const BEncodeDictView& info);
     void compute_info_hash_hex();
 };
 
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "BaseStorage.hpp"
+
+#include <mutex>
+
+// maps every file into memory on first access
+// writes are memcpy's into the mapping and are flushed in batches instead of per piece
+class MmapStorage: public BaseStorage {
+public:
+    MmapStorage(std::vector<StorageFile> files, AllocationMode allocation);
+    ~MmapStorage();
+
+    MmapStorage(const MmapStorage&) = delete;
+    MmapStorage& operator=(const MmapStorage&) = delete;
+
+    void set_access_pattern(AccessPattern pattern) override;
+    void sync() override;
+
+protected:
+    boost::asio::awaitable<bool> write_at(size_t file_index, uint64_t file_offset, std::span<const unsigned char> data) override;
+    boost::asio::awaitable<bool> read_at(size_t file_index, uint64_t file_offset, std::span<unsigned char> out) override;
+
+private:
+    struct Mapping {
+#ifdef _WIN32
+        void* file = nullptr;
+        void* mapping = nullptr;
+#endif
+        unsigned char* base = nullptr;
+
+        // a read-only view covers what is on disk so far, a writable one the whole file
+        uint64_t length{};
+        bool writable = false;
+
+        // dirty range since the last flush
+        uint64_t dirty_begin = UINT64_MAX, dirty_end = 0;
+        bool failed = false;
+    };
+
+    bool ensure_mapped(size_t file_index, bool write);
+    void advise(Mapping& m);
+    void flush_dirty(bool wait);
+    void unmap(Mapping& m);
+
+    std::vector<Mapping> _mappings;
+
+    // read-only views replaced by a writable one, a read may still be copying out of them so they live as long as the storage
+    std::vector<Mapping> _retired;
+
+    // guards mapping setup and dirty tracking, the copies themselves run unlocked on any disk thread
+    std::mutex _mutex;
+
+    AccessPattern _pattern = AccessPattern::Sequential;
+
+    // msync once this many bytes have been dirtied, rather than after every piece
+    static constexpr uint64_t FLUSH_BATCH_BYTES = 64ull * 1024 * 1024;
+    uint64_t _dirty_bytes{};
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <filesystem>
+#include <span>
+#include <cstdint>
+
+// thin wrappers over raw file handles, every read and write carries its own offset
+// so the same handle can be used from several disk threads at once
+
+#ifdef _WIN32
+using native_handle_t = void*;
+#else
+using native_handle_t = int;
+#endif
+
+extern const native_handle_t invalid_native_handle;
+
+// read-write and created if missing when write is set, otherwise read-only and a missing file stays missing
+// direct bypasses the page cache, offsets, lengths and buffers must then be multiples of DIRECT_IO_ALIGNMENT
+native_handle_t open_native(const std::filesystem::path& path, bool write = true, bool direct = false);
+
+// covers the logical sector size of everything from 512e disks to 4Kn drives and NVMe
+constexpr uint64_t DIRECT_IO_ALIGNMENT = 4096;
+void close_native(native_handle_t handle);
+
+// grow or shrink to length without allocating anything, holes read back as zeros
+bool set_file_size(native_handle_t handle, uint64_t length);
+
+// reserve every block up front so the file is laid out in one piece instead of in write order
+bool preallocate_native(native_handle_t handle, uint64_t length);
+
+// flush file data to the device, metadata only where the size changed
+bool sync_native(native_handle_t handle);
+
+// write to a temp file next to path, sync it and rename it over path
+// readers see either the old file or the new one, never a torn write
+bool write_file_atomic(const std::filesystem::path& path, std::span<const unsigned char> data);
+
+bool positional_write(native_handle_t handle, uint64_t offset, std::span<const unsigned char> data);
+bool positional_writev(native_handle_t handle, uint64_t offset, std::span<const std::span<const unsigned char>> buffers);
+bool positional_read(native_handle_t handle, uint64_t offset, std::span<unsigned char> out);
+
+// like positional_read but stops at end of file, returns how much was read or -1 on error
+int64_t positional_read_some(native_handle_t handle, uint64_t offset, std::span<unsigned char> out);
@@ -2,6 +2,7 @@
 
 #include "Peer.hpp"
 #include "Utils.hpp"
+#include "MerkleTree.hpp"
 
 #include <memory>
 #include <vector>
@@ -12,6 +13,7 @@
 #include <boost/dynamic_bitset.hpp>
 
 class PieceManager;
+struct HashRequest;
 
 class PeerConnection: public std::enable_shared_from_this<PeerConnection> {
 
@@ -58,7 +60,10 @@ private:
     enum class Message_ID: uint8_t {
         Choke = 0, Unchoke, Interested,
         NotInterested, Have, Bitfield,
-        Request, Piece, Cancel, Port
+        Request, Piece, Cancel, Port,
+
+        // BEP 52
+        HashRequest = 21, Hashes, HashReject
     };
 
     struct ParsedRequest {
@@ -102,6 +107,24 @@ private:
     void handle_piece();
     [[nodiscard]] boost::asio::awaitable<void> handle_request();
 
+    // BEP 52 hash exchange, only with peers that set the v2 bit in their handshake
+    [[nodiscard]] boost::asio::awaitable<void> send_hash_message(Message_ID id, const HashRequest& header, std::span<const Sha256> hashes = {});
+    [[nodiscard]] boost::asio::awaitable<void> handle_hash_request();
+    void handle_hashes(Message_ID id);
+    std::optional<HashRequest> parse_hash_header() const;
+
+    // our hash requests without an answer yet, handed back to the piece manager if the peer goes away
+    struct PendingHashRequest {
+        Sha256 root;
+        uint32_t index, length;
+    };
+    std::vector<PendingHashRequest> _hash_requests;
+    static constexpr size_t MAX_HASH_REQUESTS = 4;
+
+    // blocks from this peer that failed their v2 hash before we give up on it
+    static constexpr uint32_t MAX_HASH_FAILURES = 8;
+    bool _peer_v2 = false;
+
     // buffers
     std::vector<unsigned char> msg_buf;
     std::array<unsigned char, 5> _interested_buf;
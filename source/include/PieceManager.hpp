@@ -1,17 +1,29 @@
 #pragma once
 
+#include "ResumeData.hpp"
+#include "MerkleTree.hpp"
+
 #include <boost/dynamic_bitset.hpp>
 #include <boost/asio.hpp>
 
+#include <map>
 #include <span>
 #include <print>
+#include <unordered_map>
 
 class FileManager;
+struct PartialPieceWrite;
+
+// a BEP 52 hash request, or the header of the hashes / reject answering one
+struct HashRequest {
+    std::span<const unsigned char> root;
+    uint32_t base_layer, index, length, proof_layers;
+};
 
 class PieceManager
 {
 public:
-    PieceManager(boost::asio::any_io_executor disk_exec, size_t num_pieces, size_t piece_length, size_t total_size, const std::vector<std::array<unsigned char, 20>>& piece_hashes, FileManager& fm, std::function<void(uint32_t)> callback);
+    PieceManager(boost::asio::any_io_executor net_exec, boost::asio::any_io_executor disk_exec, size_t num_pieces, size_t piece_length, size_t total_size, std::span<const unsigned char> piece_hashes, std::span<const PieceRoot> piece_roots, FileManager& fm, std::function<void(uint32_t)> callback);
     ~PieceManager() {
         std::println("Pm destroyed");
     }
@@ -21,23 +33,80 @@ public:
     uint64_t total_bytes() const;
     bool is_complete() const;
     bool is_piece_complete(uint32_t piece) const;
+    uint64_t disk_queue_bytes() const { return _disk_queue_bytes; }
+    size_t disk_queue_jobs() const { return _disk_queue_jobs; }
+    bool disk_throttled() const { return _disk_throttled; }
     size_t piece_length_for_index(int piece_index) const;
 
     // public APIs
     [[nodiscard]] std::vector<uint8_t> fetch_my_bitset() const;
     [[nodiscard]] std::optional<std::tuple<int, int, int>> next_block_request(const boost::dynamic_bitset<>& peer_bitfield);
-    [[nodiscard]] void add_block(uint32_t piece, uint32_t begin, std::span<const unsigned char> block);
+    [[nodiscard]] void add_block(uint32_t piece, uint32_t begin, std::span<const unsigned char> block, const boost::asio::ip::address& from);
     [[nodiscard]] void return_block(uint32_t piece, uint32_t begin);
     [[nodiscard]] boost::asio::awaitable<std::optional<std::vector<unsigned char>>> async_fetch_block(uint32_t piece, uint32_t begin, uint32_t length);
 
+    // v2 and hybrid torrents check pieces against SHA-256 trees, with the leaf hashes of a piece every block can be checked alone
+    // they are only fetched from peers once a piece failed, after that only the bad blocks are downloaded again
+    bool has_v2() const { return !_piece_roots.empty(); }
+    [[nodiscard]] std::optional<HashRequest> next_hash_request(const boost::dynamic_bitset<>& peer_bitfield);
+    void add_hashes(const HashRequest& header, std::span<const unsigned char> hashes);
+    void return_hash_request(const HashRequest& request);
+    [[nodiscard]] std::optional<std::vector<Sha256>> serve_hashes(const HashRequest& request) const;
+
+    // blocks from this address that failed their hash
+    uint32_t hash_failures(const boost::asio::ip::address& peer) const;
+
+    // completed pieces from the resume file, has to finish before the bitfield is handed to anyone
+    [[nodiscard]] boost::asio::awaitable<void> load_resume();
+
+    // unfinished pieces survive restarts, blocks received since the last call are handed out for writing
+    [[nodiscard]] std::vector<PartialPieceWrite> collect_partial_pieces();
+    [[nodiscard]] boost::asio::awaitable<void> restore_partial_pieces();
+
+    // pieces the resume file can no longer vouch for are read back and hashed
+    [[nodiscard]] boost::asio::awaitable<void> recheck_pieces();
+
+    // stop taking blocks, restoring, rechecking and serving, then wait until every verified piece has been handed to the file manager
+    // and no upload read is left at the disk
+    void request_stop() { _stopping = true; }
+    [[nodiscard]] boost::asio::awaitable<void> drain_disk();
+
 private:
     bool endgame_required() const;
     void set_my_bitfield(uint32_t piece);
+    void update_access_pattern();
 
+    boost::asio::any_io_executor _net_exec;
     boost::asio::any_io_executor _disk_exec;
 
+    // disk jobs are ordered and shared out between torrents by the client's DiskScheduler, see FileManager
+    boost::asio::awaitable<void> write_to_disk(uint32_t piece, std::vector<unsigned char> data);
+
+    // verified piece bytes handed to the disk and not written yet
+    // over the high watermark the picker stops starting new pieces until the queue drains to the low one
+    static constexpr uint64_t DISK_QUEUE_HIGH_WATERMARK = 128ull * 1024 * 1024;
+    static constexpr uint64_t DISK_QUEUE_LOW_WATERMARK = 64ull * 1024 * 1024;
+    uint64_t _disk_queue_bytes{};
+    size_t _disk_queue_jobs{};
+    bool _disk_throttled = false;
+
+    // cancelled whenever the disk queue and the upload reads run out, drain_disk() waits on it
+    size_t _disk_reads{};
+    boost::asio::steady_timer _disk_idle;
+    bool _stopping = false;
+
     void lazy_init(uint32_t piece_index);
     bool verify_hash(uint32_t piece_index);
+    void on_piece_filled(uint32_t piece_index);
+
+    // v2 helpers, see has_v2()
+    std::vector<Sha256> hash_blocks(uint32_t piece_index) const;
+    bool block_matches(uint32_t piece_index, size_t block_index) const;
+    void reject_block(uint32_t piece_index, size_t block_index);
+    std::optional<uint32_t> piece_for(const HashRequest& request) const;
+
+    std::vector<ResumePartialPiece> _partial_to_restore;
+    std::vector<uint32_t> _pieces_to_recheck;
 
     enum class BlockState {
         NotRequested = 0,
@@ -48,6 +117,8 @@ private:
     struct PieceBuffer {
         std::vector<unsigned char> data;
         std::vector<BlockState> block_status;
+        std::vector<bool> block_persisted;
+        std::vector<boost::asio::ip::address> block_from;
         int blocks_received{};
         bool is_complete = false;
     };
@@ -60,7 +131,24 @@ private:
     size_t _piece_length;
     size_t _total_size;
     size_t _completed_pieces{};
-    const std::vector<std::array<unsigned char, 20>>& _piece_hashes;
+    // 20 bytes of SHA-1 per piece, points into the torrent's metadata
+    std::span<const unsigned char> _piece_hashes;
+
+    // per piece for v2 and hybrid torrents, empty otherwise
+    std::span<const PieceRoot> _piece_roots;
+
+    // first piece of each file, keyed by the file's pieces root
+    std::unordered_map<std::string_view, uint32_t> _first_piece;
+
+    // BEP 52 caps a single request at 512 hashes, pieces bigger than 8 MiB are only checked whole
+    static constexpr uint32_t MAX_HASHES_PER_REQUEST = 512;
+
+    // leaf hashes of pieces that failed, kept until the piece passes
+    enum class HashState: uint8_t { None, Wanted, Requested };
+    std::vector<HashState> _hash_state;
+    std::unordered_map<uint32_t, std::vector<Sha256>> _block_hashes;
+
+    std::map<boost::asio::ip::address, uint32_t> _hash_failures;
 
     uint64_t downloaded{}, uploaded{};
 
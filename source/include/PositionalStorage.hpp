@@ -0,0 +1,36 @@
+#pragma once
+
+#include "BaseStorage.hpp"
+#include "FileHandleCache.hpp"
+
+#include <mutex>
+
+// raw handles with pread/pwrite, there is no shared file position
+// so reads and writes at different offsets are safe to run on several disk threads
+// handles come from the client wide cache and may be closed between operations
+class PositionalStorage: public BaseStorage {
+public:
+    PositionalStorage(FileHandleCache& handles, std::vector<StorageFile> files, AllocationMode allocation, bool direct = false);
+    ~PositionalStorage();
+
+    void sync() override;
+
+    PositionalStorage(const PositionalStorage&) = delete;
+    PositionalStorage& operator=(const PositionalStorage&) = delete;
+
+protected:
+    boost::asio::awaitable<bool> write_at(size_t file_index, uint64_t file_offset, std::span<const unsigned char> data) override;
+    boost::asio::awaitable<bool> read_at(size_t file_index, uint64_t file_offset, std::span<unsigned char> out) override;
+    boost::asio::awaitable<bool> write_vectored_at(size_t file_index, uint64_t file_offset, std::span<const std::span<const unsigned char>> buffers) override;
+
+    std::shared_ptr<FileHandle> open_for_write(size_t file_index);
+    std::shared_ptr<FileHandle> open_for_read(size_t file_index);
+
+private:
+    FileHandleCache& _handles;
+    bool _direct;
+
+    // files written since the last sync, their handles may have been evicted in the meantime
+    std::vector<uint8_t> _dirty;
+    std::mutex _dirty_mutex;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <optional>
+#include <cstdint>
+
+// versioned fast resume file
+//
+//  "CTRS" | u32 version | u32 num_pieces | u64 piece_length
+//  u32 num_files   | { u64 size, i64 mtime } * num_files
+//  u32 bitfield_len | bitfield (wire order, msb first)
+//  u32 num_partial | { u32 piece, u32 mask_len, mask } * num_partial
+//  u32 checksum (fnv-1a over everything before it)
+//
+// all integers little endian
+
+struct ResumeFileState {
+    uint64_t size;
+    int64_t mtime;
+};
+
+// received blocks of a piece that wasn't finished, one bit per 16 KiB block
+struct ResumePartialPiece {
+    uint32_t piece;
+    std::vector<uint8_t> blocks;
+};
+
+struct ResumeData {
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t num_pieces{};
+    uint64_t piece_length{};
+
+    std::vector<ResumeFileState> files;
+    std::vector<uint8_t> bitfield;
+    std::vector<ResumePartialPiece> partial;
+
+    bool has_piece(uint32_t piece) const { return piece < num_pieces && (bitfield[piece / 8] >> (7 - piece % 8)) & 1; }
+};
+
+std::vector<unsigned char> serialize_resume(const ResumeData& data);
+std::optional<ResumeData> parse_resume(std::span<const unsigned char> in);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "BaseStorage.hpp"
+#include "FileHandleCache.hpp"
+
+#include <memory>
+
+std::unique_ptr<BaseStorage> make_storage(boost::asio::any_io_executor disk_exec, FileHandleCache& handles, StorageMode mode, AllocationMode allocation, std::vector<StorageFile> files);
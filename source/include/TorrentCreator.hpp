@@ -0,0 +1,50 @@
+#pragma once
+
+#include "MetadataParser.hpp"
+
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <cstdint>
+
+#include <boost/asio.hpp>
+
+struct CreateTorrentOptions {
+    // a single file or a directory, walked recursively
+    std::filesystem::path source;
+
+    // the first one is the announce url, with more than one each gets its own tier
+    std::vector<std::string> trackers;
+    std::string comment;
+
+    // 0 picks one from the total size, see choose_piece_length(), otherwise a power of two from 16 KiB to 16 MiB
+    uint64_t piece_length{};
+    bool is_private = false;
+
+    // hashing threads, 0 uses every core and more than that is capped to it
+    unsigned threads{};
+
+    // off for requests from the api, a link inside a shared tree must not pull in a file from outside it
+    bool follow_symlinks = true;
+};
+
+struct CreatedTorrent {
+    std::vector<char> data;
+    std::string name, info_hash_hex;
+    uint64_t total_size{}, piece_length{};
+    size_t num_pieces{}, num_files{};
+};
+
+// a power of two between 16 KiB and 16 MiB that keeps the piece count around 2000
+uint64_t choose_piece_length(uint64_t total_size);
+
+// files in the order they are laid out in the torrent, paths relative and '/' separated like Metadata builds them
+// sorted, so the same tree always makes the same torrent
+std::vector<TorrentFile> collect_files(const std::filesystem::path& source, bool follow_symlinks = true);
+
+// hashes on several threads with each one reading its own run of pieces, throws if a file can't be read
+CreatedTorrent create_torrent(const CreateTorrentOptions& options);
+
+// the same on a thread of pool, hashing a large tree blocks for as long as reading it takes
+// the pool has to outlive the call, its size is how many torrents are created at once
+boost::asio::awaitable<CreatedTorrent> async_create_torrent(boost::asio::any_io_executor pool, CreateTorrentOptions options);
@@ -3,6 +3,7 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <random>
 #include <unordered_map>
 
 #include <print>
@@ -20,10 +21,14 @@ struct TorrentSnapshot;
 struct PeerSnapshot;
 struct TrackerSnapshot;
 struct NetworkCapabilities;
+class UdpTrackerMux;
+class HttpConnectionPool;
+class DnsCache;
+class AnnounceScheduler;
 
 class TorrentSession {
 public:
-    TorrentSession(boost::asio::any_io_executor net_exec, boost::asio::any_io_executor disk_exec, Metadata&& md, const NetworkCapabilities& nc);
+    TorrentSession(boost::asio::any_io_executor net_exec, boost::asio::any_io_executor disk_exec, FileHandleCache& file_handles, DiskScheduler& disk_scheduler, Metadata&& md, const NetworkCapabilities& nc, UdpTrackerMux& udp_mux, HttpConnectionPool& http_pool, DnsCache& dns, AnnounceScheduler& announce_scheduler, StorageMode storage_mode = StorageMode::Positional, AllocationMode allocation = AllocationMode::Sparse);
     ~TorrentSession() {
         std::println("Session destroyed");
     }
@@ -37,6 +42,10 @@ public:
     TorrentSnapshot snapshot() const;
     std::vector<PeerSnapshot> peer_snapshots() const;
     std::vector<TrackerSnapshot> tracker_snapshots() const;
+
+    // for scrapes, which the client batches across sessions
+    const std::array<unsigned char, 20>& info_hash() const { return _metadata.info_hash; }
+    std::vector<std::shared_ptr<BaseTracker>> trackers() const;
     boost::asio::awaitable<void> add_inbound_peer(boost::asio::ip::tcp::socket socket, boost::asio::ip::tcp::endpoint ep, PeerDirection dir, std::string id);
     
 private:
@@ -55,29 +64,91 @@ private:
     struct TrackerState {
         std::shared_ptr<BaseTracker> _tracker_shared_ptr;
         TrackerStats stats;
-        boost::asio::steady_timer timer;
 
-        TrackerState(std::shared_ptr<BaseTracker> t, boost::asio::any_io_executor exec): _tracker_shared_ptr(std::move(t)), timer(exec) {}
+        // the tracker has seen our started event, and so is owed a stopped one
+        bool started = false;
     };
 
     bool session_stopped = false;
 
-    boost::asio::awaitable<void> tracker_loop(TrackerState& state);
-
     boost::asio::any_io_executor _net_exec;
     boost::asio::any_io_executor _disk_exec;
     
     boost::asio::strand<boost::asio::any_io_executor> peer_list_strand;
 
+    // completed pieces are committed to the resume file at least this often
+    static constexpr auto RESUME_SAVE_INTERVAL = std::chrono::seconds(30);
+    // the same loop samples the disk rates on a shorter tick
+    static constexpr auto STATS_INTERVAL = std::chrono::seconds(2);
+    boost::asio::steady_timer resume_timer;
+    boost::asio::awaitable<void> resume_loop();
+
+    // the resume loop and the startup restore and recheck hold on to _pm and _fm, stop() waits until none is left
+    // cancelled whenever the last one returns
+    boost::asio::steady_timer _background_done;
+    size_t _background_running{};
+    void spawn_background(boost::asio::awaitable<void> task);
+
+    // loads the resume state, then starts announcing and the other background tasks
+    boost::asio::awaitable<void> startup();
+
+    // inbound peers are turned away until our bitfield is known
+    bool _resume_loaded = false;
+
+    // one announce at a time per session, to the trackers picked by BEP 12 tier order
+    boost::asio::steady_timer _announce_timer;
+
+    // bounds the announce in flight, cancelled by stop() to cut it short
+    boost::asio::steady_timer _announce_deadline;
+
+    // cancelled when announce_loop() returns, stop() waits on it before sending stopped
+    boost::asio::steady_timer _announce_loop_done;
+    bool _announce_loop_running = false;
+    std::chrono::steady_clock::time_point _next_announce{}, _last_announce{};
+    uint32_t _min_interval{};
+
+    // completed goes out once, and only for a download that finished while we were running
+    bool _was_complete = false, _completed_pending = false;
+
+    boost::asio::awaitable<void> announce_loop();
+    boost::asio::awaitable<void> announce_once();
+    boost::asio::awaitable<bool> announce_to(TrackerState& state, TrackerEvent event);
+
+    // called on the net executor after a piece is written, to notice the download finishing
+    void check_completed();
+
+    // disk byte counters at the last stats tick, snapshot() only reads the rates so every caller sees the same window
+    struct DiskSample {
+        std::chrono::steady_clock::time_point time;
+        uint64_t bytes_read{}, bytes_written{};
+    };
+    DiskSample _disk_sample;
+    uint64_t _disk_read_rate{}, _disk_write_rate{};
+    void sample_disk_rates();
+
     std::string peer_id = "-TR2940-1234567890ab";
     Metadata _metadata;                                     // parsed metadata and raw string
     std::vector<TrackerState> _tracker_list;
+
+    // indices into _tracker_list, shuffled inside each tier and reordered as trackers answer
+    std::vector<std::vector<size_t>> _tiers;
+    std::mt19937 _rng{ std::random_device{}() };
     
     const uint32_t DEFAULT_ANNOUNCE_TIMER = 180;
 
+    // a tracker that hasn't answered by then counts as down, and the next one in the tier is tried
+    static constexpr auto ANNOUNCE_TIMEOUT = std::chrono::seconds(30);
+
+    // how long shutdown waits on each stopped announce
+    static constexpr auto STOP_ANNOUNCE_TIMEOUT = std::chrono::seconds(3);
+
     FileManager _fm;
     PieceManager _pm;
     const NetworkCapabilities& _nc;
+    UdpTrackerMux& _udp_mux;
+    HttpConnectionPool& _http_pool;
+    DnsCache& _dns;
+    AnnounceScheduler& _announce_scheduler;
 
     void build_tracker_list();
     boost::asio::awaitable<void> on_tracker_response(const TrackerResponse& resp);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "DiskStats.hpp"
+
 #include <string>
 #include <cstdint>
 
@@ -12,5 +14,10 @@ struct TorrentSnapshot {
 
     uint64_t trackers, peers;
 
+    uint64_t disk_queue_bytes, disk_queue_jobs;
+    bool disk_throttled;
+
+    DiskStatsSnapshot disk;
+
     std::string status; // downloading, seeding, stalled, paused
 };
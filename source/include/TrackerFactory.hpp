@@ -6,5 +6,8 @@
 
 class BaseTracker;
 struct NetworkCapabilities;
+class UdpTrackerMux;
+class HttpConnectionPool;
+class DnsCache;
 
-std::shared_ptr<BaseTracker> make_tracker(boost::asio::any_io_executor exec, const std::string_view url, const std::array<unsigned char, 20>& info_hash, const NetworkCapabilities& nc);
\ No newline at end of file
+std::shared_ptr<BaseTracker> make_tracker(boost::asio::any_io_executor exec, const std::string_view url, const std::array<unsigned char, 20>& info_hash, const NetworkCapabilities& nc, UdpTrackerMux& udp_mux, HttpConnectionPool& http_pool, DnsCache& dns);
\ No newline at end of file
@@ -8,6 +8,10 @@ struct TrackerSnapshot {
 
     uint32_t interval{}, next_in{}, peers_returned{};
 
+    // from the last scrape, scraped says whether there has been one
+    uint32_t seeders{}, leechers{}, completed{};
+    bool scraped = false;
+
     std::string status{};
 
     bool reachable = false;
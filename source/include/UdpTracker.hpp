@@ -2,11 +2,14 @@
 
 #include "BaseTracker.hpp"
 #include "NetworkCapabilities.hpp"
+#include "UdpTrackerMux.hpp"
+#include "DnsCache.hpp"
 
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/beast.hpp>
 
+#include <span>
 #include <concepts>
 
 // concepts
@@ -23,39 +26,47 @@ struct NetworkCapabilities;
 
 class UdpTracker: public BaseTracker {
 public:
-    UdpTracker(boost::asio::any_io_executor exec, std::string_view tracker_url, const std::array<unsigned char, 20>& info_hash, const NetworkCapabilities& nc): BaseTracker(exec, tracker_url, info_hash, nc) {
-        udp_v4.emplace(_exec, udp::v4());
-        if (_nc.ipv6_outbound) udp_v6.emplace(_exec, udp::v6());
+    UdpTracker(boost::asio::any_io_executor exec, std::string_view tracker_url, const std::array<unsigned char, 20>& info_hash, const NetworkCapabilities& nc, UdpTrackerMux& mux, DnsCache& dns): BaseTracker(exec, tracker_url, info_hash, nc), _mux(mux), _dns(dns) {
+        udp_v4.emplace(udp::v4());
+        if (_nc.ipv6_outbound) udp_v6.emplace(udp::v6());
     }
 
-    boost::asio::awaitable<TrackerResponse> async_announce(const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total) override; 
+    boost::asio::awaitable<TrackerResponse> async_announce(const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total, TrackerEvent event) override; 
     void stop() override;
 
+    // scrape any number of torrents at once, batched into requests of MAX_SCRAPE_HASHES
+    // results are in the order of info_hashes, nullopt where a batch went unanswered
+    boost::asio::awaitable<std::vector<std::optional<ScrapeStats>>> scrape(std::span<const std::array<unsigned char, 20>> info_hashes);
+
+    // 16 byte header and 20 bytes per hash, 74 keeps a request inside a 1500 byte datagram
+    static constexpr size_t MAX_SCRAPE_HASHES = 74;
+
 private:
     bool stopped = false;
 
+    // sockets and connection ids live in the mux, all a tracker keeps is where to send
     struct UdpContext {
-        udp::socket socket;
         udp::endpoint endpoint;
         udp proto;
-        uint64_t connection_id{};   
-        std::chrono::steady_clock::time_point expiry{};
-        bool connected = false;
-        bool bound = false;
 
-        explicit UdpContext(net::any_io_executor exec, udp protocol): socket(exec, protocol), proto(protocol) {}
+        explicit UdpContext(udp protocol): proto(protocol) {}
     };
 
     std::optional<UdpContext> udp_v4;
     std::optional<UdpContext> udp_v6;
 
-    boost::asio::awaitable<bool> ensure_socket_ready(UdpContext&);
+    UdpTrackerMux& _mux;
+    DnsCache& _dns;
+
+    boost::asio::awaitable<bool> ensure_endpoint(UdpContext&);
     static uint32_t random_u32();
-    boost::asio::awaitable<bool> send_connect(UdpContext&);
-    boost::asio::awaitable<TrackerResponse> send_announce(UdpContext& udp, const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total);
+    // sends request until it is answered or the mux retry policy runs out, nullopt then
+    // bytes 0..8 get the current connection id before every attempt, a retry can outlast the id it started with
+    boost::asio::awaitable<std::optional<UdpTrackerMux::Datagram>> send_request(UdpContext& context, std::span<unsigned char> request);
+    boost::asio::awaitable<TrackerResponse> send_announce(UdpContext& udp, const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total, TrackerEvent event);
 
-    void parse_v4(TrackerResponse& out, std::array<unsigned char, 1500>& response_buf, size_t size);
-    void parse_v6(TrackerResponse& out, std::array<unsigned char, 1500>& response_buf, size_t size);
+    void parse_v4(TrackerResponse& out, std::span<const unsigned char> response);
+    void parse_v6(TrackerResponse& out, std::span<const unsigned char> response);
 
     template <MutableBuffer Buffer, UnsignedNum Value>
     auto write_buffer(Buffer& buf, Value val, size_t& Offset) -> void {
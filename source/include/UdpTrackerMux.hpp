@@ -0,0 +1,96 @@
+#pragma once
+
+#include <map>
+#include <span>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+
+#include <boost/asio.hpp>
+
+struct NetworkCapabilities;
+
+// BEP 15 waits 15 * 2^n seconds for a response before sending again, with n going up to 8, over two hours in all
+// max_retries caps n lower so a dead tracker is given up on in minutes and the announce is retried on the normal interval
+struct UdpRetryPolicy {
+    std::chrono::seconds base_timeout{ 15 };
+    unsigned max_retries = 8;
+
+    std::chrono::milliseconds timeout(unsigned retry) const { return base_timeout * (1u << std::min(retry, 8u)); }
+};
+
+// every udp tracker of every torrent talks through here, one socket per address family
+// responses are matched to requests by transaction id, so any number of announces can be in flight on one socket
+// connection ids are kept per tracker endpoint, a tracker shared by many torrents is connected to once, not once per torrent
+class UdpTrackerMux {
+public:
+    using udp = boost::asio::ip::udp;
+    using Datagram = std::vector<unsigned char>;
+
+    UdpTrackerMux(boost::asio::any_io_executor exec, const NetworkCapabilities& nc, UdpRetryPolicy retry = {});
+
+    UdpTrackerMux(const UdpTrackerMux&) = delete;
+    UdpTrackerMux& operator=(const UdpTrackerMux&) = delete;
+
+    // sends request and waits for the datagram from endpoint with the same transaction id
+    // the transaction id is picked here and written at bytes 12..16, where every BEP 15 request keeps it
+    // nullopt on timeout, on a send error, or when owner is cancelled
+    boost::asio::awaitable<std::optional<Datagram>> transact(udp::endpoint endpoint, std::span<unsigned char> request, std::chrono::milliseconds timeout, const void* owner);
+
+    // cached connection id for endpoint, connects when there is none or it expired
+    // concurrent callers for the same endpoint share a single connect
+    boost::asio::awaitable<std::optional<uint64_t>> connection_id(udp::endpoint endpoint, std::chrono::milliseconds timeout, const void* owner);
+
+    // a tracker answering with an error may no longer know our id
+    void forget_connection(const udp::endpoint& endpoint);
+
+    // wakes every request made by owner, a stopping tracker should not wait out its timeouts
+    void cancel(const void* owner);
+
+    // trackers read this before every request, so a change applies from their next retry
+    const UdpRetryPolicy& retry_policy() const { return _retry; }
+    void set_retry_policy(UdpRetryPolicy retry) { _retry = retry; }
+
+private:
+    // everything below only runs on the strand
+    boost::asio::awaitable<std::optional<Datagram>> do_transact(udp::endpoint endpoint, std::span<unsigned char> request, std::chrono::milliseconds timeout, const void* owner);
+    boost::asio::awaitable<std::optional<uint64_t>> do_connection_id(udp::endpoint endpoint, std::chrono::milliseconds timeout, const void* owner);
+    boost::asio::awaitable<void> receive_loop(udp::socket& socket);
+
+    // opened and bound on first use, the network capabilities are only known once the client runs
+    udp::socket* socket_for(const udp::endpoint& endpoint);
+
+    boost::asio::strand<boost::asio::any_io_executor> _strand;
+    const NetworkCapabilities& _nc;
+    UdpRetryPolicy _retry;
+
+    std::optional<udp::socket> _v4, _v6;
+
+    // a waiting request, the pointers are into the waiting coroutine's frame
+    struct Pending {
+        udp::endpoint endpoint;
+        const void* owner;
+        boost::asio::steady_timer* timer;
+        std::optional<Datagram>* response;
+    };
+    std::unordered_map<uint32_t, Pending> _pending;
+
+    struct Connection {
+        uint64_t id{};
+        std::chrono::steady_clock::time_point expiry{};
+
+        // set while a connect is in flight, cancelled when it finishes
+        std::shared_ptr<boost::asio::steady_timer> connecting;
+    };
+    std::map<udp::endpoint, Connection> _connections;
+
+    // BEP 15, a client may use a connection id for a minute after receiving it
+    static constexpr auto CONNECTION_ID_LIFETIME = std::chrono::seconds(60);
+
+    // larger than any announce a tracker sends, it caps peers well below this
+    static constexpr size_t MAX_DATAGRAM = 8192;
+};
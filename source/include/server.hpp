@@ -3,6 +3,8 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <optional>
+#include <filesystem>
 
 #include <boost/asio.hpp>
 #include <boost/beast.hpp>
@@ -15,12 +17,14 @@ class Client;
 struct UploadedFile {
     std::string filename;
     std::vector<char> data;
+    std::string storage;
+    std::string allocation;
     bool valid = false;
 };
 
 class HttpServer : public std::enable_shared_from_this<HttpServer> {
 public:
-    HttpServer(boost::asio::any_io_executor ioc, unsigned short port, std::string doc_root, Client* client);
+    HttpServer(boost::asio::any_io_executor ioc, unsigned short port, std::string doc_root, std::filesystem::path share_root, Client* client);
 
     void run(); // start accepting connections asynchronously
 
@@ -38,12 +42,17 @@ private:
     std::string mime_type(const std::string& path);
     std::string load_file(const std::string& path);
 
+    // relative path inside the share root, nullopt for anything that would leave it
+    std::optional<std::filesystem::path> resolve_shared(std::string_view relative) const;
+
     void handle_static(const http::request<http::dynamic_body>& req,
                        http::response<http::string_body>& res);
     boost::asio::awaitable<void> handle_api(const http::request<http::dynamic_body>& req,
                     http::response<http::string_body>& res);
     void handle_add_torrent(const http::request<http::dynamic_body>& req,
                             http::response<http::string_body>& res);
+    boost::asio::awaitable<void> handle_create_torrent(const http::request<http::dynamic_body>& req,
+                            http::response<http::string_body>& res);
     boost::asio::awaitable<void> handle_delete_torrent(const http::request<http::dynamic_body>& req,
                             http::response<http::string_body>& res, const std::string& hash);                        
     void fetch_torrents_info(const http::request<http::dynamic_body>& req,
@@ -52,10 +61,13 @@ private:
                             http::response<http::string_body>& res, const std::string& hash);
     void fetch_trackers_info(const http::request<http::dynamic_body>& req,
                             http::response<http::string_body>& res, const std::string& hash);
+    void fetch_disk_stats(const http::request<http::dynamic_body>& req,
+                            http::response<http::string_body>& res);
 
 private:
     boost::asio::any_io_executor _exec;
     unsigned short _port;
     std::string _doc_root;
+    std::filesystem::path _share_root;
     Client* _client;
 };
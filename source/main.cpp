@@ -1,12 +1,62 @@
 #include "Client.hpp"
+#include "TorrentCreator.hpp"
+#include "NativeFile.hpp"
 
-int main() {
+#include <string_view>
+
+namespace {
+    // ctorrent create <path> [-o out.torrent] [-t tracker]... [-c comment] [-p piece_length] [-j threads] [--private]
+    int create(int argc, char** argv) {
+        CreateTorrentOptions options;
+        std::filesystem::path output;
+
+        for (int i = 2; i < argc; ++i) {
+            std::string_view arg = argv[i];
+            bool has_value = i + 1 < argc;
+
+            if (arg == "--private") options.is_private = true;
+            else if (arg == "-o" && has_value) output = argv[++i];
+            else if (arg == "-t" && has_value) options.trackers.emplace_back(argv[++i]);
+            else if (arg == "-c" && has_value) options.comment = argv[++i];
+            else if (arg == "-p" && has_value) options.piece_length = std::stoull(argv[++i]);
+            else if (arg == "-j" && has_value) options.threads = static_cast<unsigned>(std::stoul(argv[++i]));
+            else if (options.source.empty() && !arg.starts_with('-')) options.source = arg;
+            else {
+                std::println("Unknown argument {}", arg);
+                return 1;
+            }
+        }
+
+        if (options.source.empty()) {
+            std::println("Usage: ctorrent create <path> [-o out.torrent] [-t tracker]... [-c comment] [-p piece_length] [-j threads] [--private]");
+            return 1;
+        }
+
+        auto created = create_torrent(options);
+        if (output.empty()) output = created.name + ".torrent";
+
+        std::span bytes(reinterpret_cast<const unsigned char*>(created.data.data()), created.data.size());
+        if (!write_file_atomic(output, bytes)) {
+            std::println("Could not write {}", output.string());
+            return 1;
+        }
+
+        std::println("{} {} files, {} bytes, {} pieces of {}", created.info_hash_hex, created.num_files, created.total_size, created.num_pieces, created.piece_length);
+        std::println("Wrote {}", output.string());
+        return 0;
+    }
+}
+
+int main(int argc, char** argv) {
     try {
+        if (argc > 1 && std::string_view(argv[1]) == "create") return create(argc, argv);
+
         Client c;
         c.run();
     }
 
     catch (const std::exception& ex) {
         std::println("{}", ex.what());
+        return 1;
     }
-}
\ No newline at end of file
+}
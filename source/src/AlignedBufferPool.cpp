@@ -0,0 +1,39 @@
+#include "AlignedBufferPool.hpp"
+
+#include <new>
+
+AlignedBufferPool::~AlignedBufferPool() {
+    for (auto* data: _idle) free(data);
+}
+
+AlignedBufferPool::Buffer AlignedBufferPool::acquire() {
+    {
+        std::lock_guard lock(_mutex);
+
+        if (!_idle.empty()) {
+            auto* data = _idle.back();
+            _idle.pop_back();
+            return Buffer(data, Release{ this });
+        }
+    }
+
+    auto* data = static_cast<unsigned char*>(::operator new(_buffer_size, std::align_val_t{ _alignment }));
+    return Buffer(data, Release{ this });
+}
+
+void AlignedBufferPool::release(unsigned char* data) {
+    {
+        std::lock_guard lock(_mutex);
+
+        if (_idle.size() < _max_idle) {
+            _idle.push_back(data);
+            return;
+        }
+    }
+
+    free(data);
+}
+
+void AlignedBufferPool::free(unsigned char* data) const {
+    ::operator delete(data, std::align_val_t{ _alignment });
+}
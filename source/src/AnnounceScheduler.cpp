@@ -0,0 +1,28 @@
+#include "AnnounceScheduler.hpp"
+
+#include <algorithm>
+
+namespace net = boost::asio;
+
+AnnounceScheduler::AnnounceScheduler(boost::asio::any_io_executor exec): _strand(net::make_strand(exec)) {}
+
+// the strand is only held while picking the slot
+boost::asio::awaitable<std::chrono::steady_clock::time_point> AnnounceScheduler::acquire(std::string host) {
+    co_return co_await net::co_spawn(_strand, reserve(std::move(host)), net::use_awaitable);
+}
+
+boost::asio::awaitable<std::chrono::steady_clock::time_point> AnnounceScheduler::reserve(std::string host) {
+    auto now = std::chrono::steady_clock::now();
+
+    if (_next_host.size() > PRUNE_SIZE) {
+        std::erase_if(_next_host, [now](const auto& item) { return item.second <= now; });
+    }
+
+    auto& next_host = _next_host[host];
+    auto slot = std::max({ now, _next_any, next_host });
+
+    _next_any = slot + GLOBAL_SPACING;
+    next_host = slot + HOST_SPACING;
+
+    co_return slot;
+}
@@ -0,0 +1,76 @@
+#include "AsyncFileStorage.hpp"
+
+#include <print>
+#include <vector>
+
+#if defined(BOOST_ASIO_HAS_FILE) && !defined(_WIN32)
+
+namespace {
+    // wraps a cached handle for one operation, released rather than closed so the cache keeps owning it
+    class BorrowedFile {
+    public:
+        BorrowedFile(boost::asio::any_io_executor exec, native_handle_t handle): _file(exec, handle) {}
+        ~BorrowedFile() {
+            boost::system::error_code ec;
+            _file.release(ec);
+        }
+
+        BorrowedFile(const BorrowedFile&) = delete;
+        BorrowedFile& operator=(const BorrowedFile&) = delete;
+
+        boost::asio::random_access_file& get() { return _file; }
+
+    private:
+        boost::asio::random_access_file _file;
+    };
+}
+
+AsyncFileStorage::AsyncFileStorage(boost::asio::any_io_executor exec, FileHandleCache& handles, std::vector<StorageFile> files, AllocationMode allocation):
+    PositionalStorage(handles, std::move(files), allocation), _exec(exec) {}
+
+// the cache entry is held until the operation completes, so an eviction can't close the file under it
+boost::asio::awaitable<bool> AsyncFileStorage::write_at(size_t file_index, uint64_t file_offset, std::span<const unsigned char> data) {
+    auto handle = open_for_write(file_index);
+    if (!handle) co_return false;
+
+    BorrowedFile file(_exec, handle->handle);
+
+    boost::system::error_code ec;
+    co_await boost::asio::async_write_at(file.get(), file_offset, boost::asio::buffer(data.data(), data.size()), boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+    if (ec) std::println("Write to {} failed: {}", _files[file_index].path.string(), ec.message());
+    co_return !ec;
+}
+
+// opened read-only unless the file is already open for writing, so seeding from read-only files works
+boost::asio::awaitable<bool> AsyncFileStorage::read_at(size_t file_index, uint64_t file_offset, std::span<unsigned char> out) {
+    auto handle = open_for_read(file_index);
+    if (!handle) co_return false;
+
+    BorrowedFile file(_exec, handle->handle);
+
+    boost::system::error_code ec;
+    co_await boost::asio::async_read_at(file.get(), file_offset, boost::asio::buffer(out.data(), out.size()), boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+    co_return !ec;
+}
+
+// the positional override would block the disk thread on pwritev, the whole run goes to the kernel as one gathered submission instead
+boost::asio::awaitable<bool> AsyncFileStorage::write_vectored_at(size_t file_index, uint64_t file_offset, std::span<const std::span<const unsigned char>> buffers) {
+    auto handle = open_for_write(file_index);
+    if (!handle) co_return false;
+
+    std::vector<boost::asio::const_buffer> sequence;
+    sequence.reserve(buffers.size());
+    for (auto buffer: buffers) sequence.emplace_back(buffer.data(), buffer.size());
+
+    BorrowedFile file(_exec, handle->handle);
+
+    boost::system::error_code ec;
+    co_await boost::asio::async_write_at(file.get(), file_offset, sequence, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+    if (ec) std::println("Write to {} failed: {}", _files[file_index].path.string(), ec.message());
+    co_return !ec;
+}
+
+#endif
@@ -1,4 +1,5 @@
-#include "Bencode.hpp"
+#include "BEncode.hpp"
+#include "BEncodeScan.hpp"
 #include <cctype>
 
 BEncodeParser::BEncodeParser(const std::string& input) : _data(input), pos(0) {}
@@ -46,10 +47,8 @@ int64_t BEncodeParser::parse_int() {
         if (pos < _data.size() && std::isdigit(static_cast<unsigned char>(_data[pos])))
             throw std::runtime_error("Leading zeros not allowed");
     } else {
-        while (pos < _data.size() && std::isdigit(static_cast<unsigned char>(_data[pos]))) {
-            value = value * 10 + (_data[pos] - '0');
-            ++pos;
-        }
+        size_t end = scan_digits(_data, pos);
+        for (; pos < end; ++pos) value = value * 10 + (_data[pos] - '0');
     }
     if (_data[pos] != 'e') throw std::runtime_error("Missing 'e' for integer");
     ++pos; // skip 'e'
@@ -58,18 +57,15 @@ int64_t BEncodeParser::parse_int() {
 
 // parse string: <len>:<data>
 std::string_view BEncodeParser::parse_string() {
-    // parse length
-    size_t colon = _data.find(':', pos);
-    if (colon == std::string::npos) throw std::runtime_error("Missing ':' in string");
+    // parse length, the digit run is found with one vectorized scan
+    size_t colon = scan_digits(_data, pos);
+    if (colon == pos || colon >= _data.size() || _data[colon] != ':') throw std::runtime_error("Missing ':' in string");
+    if (colon - pos > 19) throw std::runtime_error("String length exceeds input");
     // parse number without allocating
     size_t len = 0;
-    for (size_t i = pos; i < colon; ++i) {
-        char ch = _data[i];
-        if (!std::isdigit(static_cast<unsigned char>(ch))) throw std::runtime_error("Invalid string length");
-        len = len * 10 + (ch - '0');
-    }
+    for (size_t i = pos; i < colon; ++i) len = len * 10 + (_data[i] - '0');
     pos = colon + 1;
-    if (pos + len > _data.size()) throw std::runtime_error("String length exceeds input");
+    if (len > _data.size() - pos) throw std::runtime_error("String length exceeds input");
     // create string_view pointing into original data
     std::string_view sv(_data.data() + pos, len);
     pos += len;
@@ -0,0 +1,57 @@
+#include "BEncodeScan.hpp"
+
+// BENCODE_SCAN_SCALAR builds the fallback on every target, to test it or to benchmark against it
+#if defined(BENCODE_SCAN_SCALAR)
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BENCODE_SCAN_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define BENCODE_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+#include <bit>
+#include <cstdint>
+
+namespace {
+    bool is_digit(char c) { return c >= '0' && c <= '9'; }
+}
+
+// 16 bytes per step while there are 16 left, the tail goes byte by byte
+size_t scan_digits(std::string_view data, size_t pos) {
+    const char* p = data.data();
+    const size_t size = data.size();
+
+#if defined(BENCODE_SCAN_SSE2)
+    // signed compares, bytes >= 0x80 are negative and fail the lower bound
+    const __m128i below = _mm_set1_epi8('0' - 1);
+    const __m128i above = _mm_set1_epi8('9' + 1);
+
+    while (pos + 16 <= size) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + pos));
+        __m128i digits = _mm_and_si128(_mm_cmpgt_epi8(v, below), _mm_cmplt_epi8(v, above));
+
+        auto mask = static_cast<uint32_t>(~_mm_movemask_epi8(digits)) & 0xFFFF;
+        if (mask) return pos + static_cast<size_t>(std::countr_zero(mask));
+
+        pos += 16;
+    }
+#elif defined(BENCODE_SCAN_NEON)
+    const uint8x16_t zero = vdupq_n_u8('0');
+    const uint8x16_t nine = vdupq_n_u8(9);
+
+    while (pos + 16 <= size) {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p + pos));
+        uint8x16_t digits = vcleq_u8(vsubq_u8(v, zero), nine);
+
+        // no movemask on neon, narrowing gives 4 bits per byte in a 64 bit word instead
+        uint64_t mask = ~vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(digits), 4)), 0);
+        if (mask) return pos + static_cast<size_t>(std::countr_zero(mask) / 4);
+
+        pos += 16;
+    }
+#endif
+
+    while (pos < size && is_digit(p[pos])) ++pos;
+    return pos;
+}
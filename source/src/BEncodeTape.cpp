@@ -0,0 +1,234 @@
+#include "BEncodeTape.hpp"
+#include "BEncodeScan.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+    bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+    // 19 digits always fit, so the run is bounded once instead of checking every step
+    constexpr size_t MAX_DIGITS = 19;
+
+    uint64_t to_number(std::string_view digits) {
+        uint64_t value{};
+        for (char c: digits) value = value * 10 + static_cast<uint64_t>(c - '0');
+        return value;
+    }
+}
+
+const BEncodeToken& BEncodeView::token() const {
+    return _tape->_tokens[_token];
+}
+
+int64_t BEncodeView::as_int() const {
+    if (!is_int()) throw std::runtime_error("Not an integer");
+    return token().value;
+}
+
+std::string_view BEncodeView::as_string() const {
+    if (!is_string()) throw std::runtime_error("Not a string");
+
+    const auto& t = token();
+    return _tape->_data.substr(static_cast<size_t>(t.value), static_cast<size_t>(t.end - t.value));
+}
+
+BEncodeListView BEncodeView::as_list() const {
+    if (!is_list()) throw std::runtime_error("Not a list");
+    return { _tape, _token };
+}
+
+BEncodeDictView BEncodeView::as_dict() const {
+    if (!is_dict()) throw std::runtime_error("Not a dictionary");
+    return { _tape, _token };
+}
+
+std::string_view BEncodeView::raw() const {
+    const auto& t = token();
+    return _tape->_data.substr(static_cast<size_t>(t.begin), static_cast<size_t>(t.end - t.begin));
+}
+
+BEncodeListView::iterator& BEncodeListView::iterator::operator++() {
+    _token = _tape->_tokens[_token].next;
+    return *this;
+}
+
+BEncodeListView::BEncodeListView(const BEncodeTapeParser* tape, uint32_t token): _tape(tape) {
+    const auto& t = tape->_tokens[token];
+
+    _first = token + 1;
+    _last = t.next;
+    _size = t.count;
+}
+
+// the value of an entry is the token right after its key
+BEncodeDictView::value_type BEncodeDictView::iterator::operator*() const {
+    BEncodeView key(_tape, *_entry);
+    return { key.as_string(), BEncodeView(_tape, *_entry + 1) };
+}
+
+BEncodeDictView::BEncodeDictView(const BEncodeTapeParser* tape, uint32_t token): _tape(tape) {
+    const auto& t = tape->_tokens[token];
+
+    _entries = tape->_keys.data() + t.index;
+    _size = t.count;
+}
+
+BEncodeDictView::iterator BEncodeDictView::find(std::string_view key) const {
+    auto key_of = [this](uint32_t entry) { return BEncodeView(_tape, entry).as_string(); };
+
+    auto it = std::lower_bound(_entries, _entries + _size, key, [&](uint32_t entry, std::string_view k) { return key_of(entry) < k; });
+    if (it == _entries + _size || key_of(*it) != key) return end();
+
+    return { _tape, it };
+}
+
+BEncodeView BEncodeDictView::at(std::string_view key) const {
+    auto it = find(key);
+    if (it == end()) throw std::out_of_range("Missing key: " + std::string(key));
+
+    return (*it).second;
+}
+
+// iterative, so a deeply nested input can't run us out of stack
+BEncodeView BEncodeTapeParser::parse() {
+    _tokens.clear();
+    _keys.clear();
+    _open_keys.clear();
+
+    // a token per few bytes is typical, a rough guess avoids most regrowth
+    _tokens.reserve(_data.size() / 16 + 1);
+
+    struct Frame {
+        uint32_t token;
+        size_t keys_begin;
+        bool dict, want_key;
+    };
+
+    std::vector<Frame> stack;
+    size_t pos{};
+
+    do {
+        if (pos >= _data.size()) throw std::runtime_error("Unexpected end of input");
+
+        char c = _data[pos];
+
+        if (!stack.empty() && c == 'e') {
+            auto frame = stack.back();
+            stack.pop_back();
+
+            if (frame.dict && !frame.want_key) throw std::runtime_error("Dictionary key without a value");
+
+            auto& t = _tokens[frame.token];
+            t.next = static_cast<uint32_t>(_tokens.size());
+            t.end = ++pos;
+
+            if (frame.dict) close_dict(frame.token, frame.keys_begin);
+            continue;
+        }
+
+        auto index = static_cast<uint32_t>(_tokens.size());
+
+        if (!stack.empty()) {
+            auto& parent = stack.back();
+
+            if (parent.dict && parent.want_key) {
+                if (!is_digit(c)) throw std::runtime_error("Dictionary key must be a string");
+
+                auto begin = pos;
+                auto length = parse_length(pos);
+                _tokens.push_back({ BEncodeKind::String, index + 1, 0, 0, begin, pos + length, static_cast<int64_t>(pos) });
+                pos += length;
+
+                _open_keys.push_back(index);
+                parent.want_key = false;
+                continue;
+            }
+
+            // a value completes a dict entry or adds a list element
+            ++_tokens[parent.token].count;
+            if (parent.dict) {
+                --_tokens[parent.token].count;
+                parent.want_key = true;
+            }
+        }
+
+        auto begin = pos;
+
+        if (c == 'i') {
+            auto value = parse_int(pos);
+            _tokens.push_back({ BEncodeKind::Int, index + 1, 0, 0, begin, pos, value });
+        }
+        else if (is_digit(c)) {
+            auto length = parse_length(pos);
+            _tokens.push_back({ BEncodeKind::String, index + 1, 0, 0, begin, pos + length, static_cast<int64_t>(pos) });
+            pos += length;
+        }
+        else if (c == 'l' || c == 'd') {
+            bool dict = c == 'd';
+            _tokens.push_back({ dict ? BEncodeKind::Dict : BEncodeKind::List, 0, 0, 0, begin, 0, 0 });
+            stack.push_back({ index, _open_keys.size(), dict, dict });
+            ++pos;
+        }
+        else {
+            throw std::runtime_error(std::string("Invalid BEncode token: ") + c);
+        }
+    } while (!stack.empty());
+
+    return { this, 0 };
+}
+
+// the spec wants keys sorted already, only sort when an encoder didn't bother
+// ties keep input order, so a duplicate key finds its first occurrence like BEncodeParser's map does
+void BEncodeTapeParser::close_dict(uint32_t token, size_t keys_begin) {
+    auto first = _open_keys.begin() + static_cast<std::ptrdiff_t>(keys_begin);
+    auto key_of = [this](uint32_t key) { return BEncodeView(this, key).as_string(); };
+    auto less = [&](uint32_t a, uint32_t b) { return key_of(a) < key_of(b); };
+
+    if (!std::is_sorted(first, _open_keys.end(), less)) std::stable_sort(first, _open_keys.end(), less);
+
+    auto& t = _tokens[token];
+    t.index = static_cast<uint32_t>(_keys.size());
+    t.count = static_cast<uint32_t>(_open_keys.end() - first);
+
+    _keys.insert(_keys.end(), first, _open_keys.end());
+    _open_keys.erase(first, _open_keys.end());
+}
+
+// i-123e or i0e, no leading zeros and no negative zero
+int64_t BEncodeTapeParser::parse_int(size_t& pos) const {
+    ++pos;
+
+    bool negative = pos < _data.size() && _data[pos] == '-';
+    if (negative) ++pos;
+
+    if (pos >= _data.size() || !is_digit(_data[pos])) throw std::runtime_error("Invalid integer");
+    if (_data[pos] == '0' && (negative || (pos + 1 < _data.size() && is_digit(_data[pos + 1])))) throw std::runtime_error("Leading zeros not allowed");
+
+    auto end = scan_digits(_data, pos);
+    if (end - pos > MAX_DIGITS) throw std::runtime_error("Integer out of range");
+
+    auto value = to_number(_data.substr(pos, end - pos));
+    pos = end;
+
+    if (pos >= _data.size() || _data[pos] != 'e') throw std::runtime_error("Missing 'e' for integer");
+    ++pos;
+
+    if (value > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) throw std::runtime_error("Integer out of range");
+    return negative ? -static_cast<int64_t>(value) : static_cast<int64_t>(value);
+}
+
+// <len>: leaves pos on the first byte of the payload
+uint64_t BEncodeTapeParser::parse_length(size_t& pos) const {
+    auto end = scan_digits(_data, pos);
+    if (end - pos > MAX_DIGITS) throw std::runtime_error("String length exceeds input");
+
+    auto length = to_number(_data.substr(pos, end - pos));
+    pos = end;
+
+    if (pos >= _data.size() || _data[pos] != ':') throw std::runtime_error("Missing ':' in string");
+    ++pos;
+
+    if (length > _data.size() - pos) throw std::runtime_error("String length exceeds input");
+    return length;
+}
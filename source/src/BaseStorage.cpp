@@ -0,0 +1,139 @@
+#include "BaseStorage.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <print>
+
+size_t BaseStorage::file_index_for(uint64_t offset) const {
+    auto start = std::ranges::upper_bound(_files, offset, {}, &StorageFile::offset);
+    if (start != _files.begin()) start = prev(start);
+
+    return static_cast<size_t>(start - _files.begin());
+}
+
+boost::asio::awaitable<bool> BaseStorage::write(uint64_t offset, std::span<const unsigned char> data) {
+    uint64_t remaining = data.size();
+    uint64_t data_offset = 0;
+
+    auto index = file_index_for(offset);
+
+    while (remaining > 0) {
+        assert(index < _files.size() && "https://en.cppreference.com/cpp/algorithm/ranges/upper_bound");
+        const auto& file = _files[index];
+
+        uint64_t file_offset = offset > file.offset ? offset - file.offset : 0;
+        uint64_t write_size = std::min(remaining, file.length - file_offset);
+
+        if (write_size > 0 && !file.pad && !co_await write_at(index, file_offset, data.subspan(data_offset, write_size))) co_return false;
+
+        remaining -= write_size;
+        data_offset += write_size;
+        offset += write_size;
+
+        ++index;
+    }
+
+    co_return true;
+}
+
+boost::asio::awaitable<bool> BaseStorage::read(uint64_t offset, std::span<unsigned char> out) {
+    uint64_t remaining = out.size();
+    uint64_t data_offset = 0;
+
+    auto index = file_index_for(offset);
+
+    while (remaining > 0) {
+        if (index >= _files.size()) co_return false;
+        const auto& file = _files[index];
+
+        uint64_t file_offset = offset > file.offset ? offset - file.offset : 0;
+        uint64_t read_size = std::min(remaining, file.length - file_offset);
+
+        if (read_size > 0 && file.pad) std::fill_n(out.begin() + data_offset, read_size, 0);
+        else if (read_size > 0 && !co_await read_at(index, file_offset, out.subspan(data_offset, read_size))) co_return false;
+
+        remaining   -= read_size;
+        data_offset += read_size;
+        offset      += read_size;
+
+        ++index;
+    }
+
+    co_return true;
+}
+
+boost::asio::awaitable<bool> BaseStorage::write_vectored(uint64_t offset, std::span<const std::span<const unsigned char>> buffers) {
+    auto index = file_index_for(offset);
+
+    // buffers are cut at file boundaries, each file gets a single gathered write
+    std::vector<std::span<const unsigned char>> segment;
+    uint64_t segment_start = offset;
+
+    for (auto buffer: buffers) {
+        while (!buffer.empty()) {
+            assert(index < _files.size() && "write runs past the end of the torrent");
+
+            uint64_t file_end = _files[index].offset + _files[index].length;
+
+            if (offset >= file_end) {
+                if (!segment.empty() && !_files[index].pad && !co_await write_vectored_at(index, segment_start - _files[index].offset, segment)) co_return false;
+
+                segment.clear();
+                segment_start = offset;
+                ++index;
+                continue;
+            }
+
+            auto take = std::min<uint64_t>(buffer.size(), file_end - offset);
+
+            segment.push_back(buffer.first(take));
+            buffer = buffer.subspan(take);
+            offset += take;
+        }
+    }
+
+    if (!segment.empty() && !_files[index].pad && !co_await write_vectored_at(index, segment_start - _files[index].offset, segment)) co_return false;
+    co_return true;
+}
+
+boost::asio::awaitable<bool> BaseStorage::write_vectored_at(size_t file_index, uint64_t file_offset, std::span<const std::span<const unsigned char>> buffers) {
+    for (auto buffer: buffers) {
+        if (!co_await write_at(file_index, file_offset, buffer)) co_return false;
+        file_offset += buffer.size();
+    }
+
+    co_return true;
+}
+
+void BaseStorage::create_parent_directories(size_t file_index) {
+    std::error_code ec;
+    std::filesystem::create_directories(_files[file_index].path.parent_path(), ec);
+}
+
+void BaseStorage::allocate(size_t file_index, native_handle_t handle) {
+    {
+        std::lock_guard lock(_allocate_mutex);
+        if (_allocated[file_index]) return;
+        _allocated[file_index] = true;
+    }
+
+    const auto& file = _files[file_index];
+    bool ok = true;
+
+    switch (_allocation) {
+        case AllocationMode::Sparse: ok = set_file_size(handle, file.length); break;
+        case AllocationMode::Full: ok = preallocate_native(handle, file.length); break;
+        case AllocationMode::None: break;
+    }
+
+    if (!ok) std::println("Could not allocate {}", file.path.string());
+}
+
+void BaseStorage::create_empty_files() {
+    for (size_t i{}; i < _files.size(); ++i) {
+        if (_files[i].length != 0 || _files[i].pad) continue;
+
+        create_parent_directories(i);
+        close_native(open_native(_files[i].path));
+    }
+}
@@ -3,6 +3,10 @@
 #include "TorrentSnapshot.hpp"
 #include "PeerSnapshot.hpp"
 #include "TrackerSnapshot.hpp"
+#include "UdpTracker.hpp"
+
+#include <algorithm>
+#include <thread>
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -16,14 +20,22 @@ void Client::run() {
     detect_network_capabilities();
     start_acceptors();
 
+    boost::asio::co_spawn(_ioc, scrape_loop(), boost::asio::detached);
+
     auto exe_dir  = get_exe_dir();
     auto doc_root = compute_doc_root();
+    auto share_root = compute_share_root();
 
-    HttpServer server(_ioc.get_executor(), 8080, doc_root, this);
+    HttpServer server(_ioc.get_executor(), 8080, doc_root, share_root, this);
     server.run();
     _ioc.run();
 }
 
+// enough threads to keep a few disks busy, more than this just adds seeks
+size_t Client::disk_thread_count() {
+    return std::clamp<size_t>(std::thread::hardware_concurrency() / 2, 2, 8);
+}
+
 std::filesystem::path Client::get_exe_dir() const {
 #ifdef _WIN32
     char buffer[MAX_PATH];
@@ -41,15 +53,39 @@ std::string Client::compute_doc_root() const {
         .string();
 }
 
-AddTorrentResult Client::add_torrent(const std::vector<char>& data) {
-    Metadata md(data);
+std::filesystem::path Client::compute_share_root() const {
+    if (const char* root = std::getenv("CTORRENT_SHARE_ROOT"); root && *root) return std::filesystem::path(root);
+    return std::filesystem::current_path();
+}
+
+boost::asio::awaitable<CreatedTorrent> Client::create_torrent(CreateTorrentOptions options) {
+    if (_pending_creates >= MAX_PENDING_CREATES) throw std::runtime_error("Too many torrents being created, try again later");
+
+    ++_pending_creates;
+
+    CreatedTorrent created;
+    std::exception_ptr error;
+
+    try { created = co_await async_create_torrent(_create_pool.get_executor(), std::move(options)); }
+    catch (...) { error = std::current_exception(); }
 
+    --_pending_creates;
+
+    if (error) std::rethrow_exception(error);
+    co_return created;
+}
+
+AddTorrentResult Client::add_torrent(std::vector<char> data, StorageMode storage_mode, AllocationMode allocation) {
+    return add_torrent(Metadata(std::move(data)), storage_mode, allocation);
+}
+
+AddTorrentResult Client::add_torrent(Metadata&& md, StorageMode storage_mode, AllocationMode allocation) {
     auto hash = md.info_hash_hex;
 
     if (_sessions.contains(hash)) return { hash, std::string(md.name), false, "Torrent already exists" };
 
     // spawn a session
-    auto session = std::make_unique<TorrentSession>(_ioc.get_executor(), _disk_pool.get_executor(), std::move(md), nc);
+    auto session = std::make_unique<TorrentSession>(_ioc.get_executor(), _disk_pool.get_executor(), _file_handles, _disk_scheduler, std::move(md), nc, _udp_trackers, _http_trackers, _dns, _announce_scheduler, storage_mode, allocation);
 
     session->start();
 
@@ -68,6 +104,56 @@ boost::asio::awaitable<void> Client::remove_if_exists(const std::string& hash, b
     co_return;
 }
 
+boost::asio::awaitable<void> Client::scrape_loop() {
+    _scrape_timer.expires_after(SCRAPE_DELAY);
+
+    for (;;) {
+        boost::system::error_code ec;
+        co_await _scrape_timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        if (ec) co_return;
+
+        scrape_udp_trackers();
+        _scrape_timer.expires_after(SCRAPE_INTERVAL);
+    }
+}
+
+void Client::scrape_udp_trackers() {
+    // every torrent on the same tracker url goes into the same requests
+    struct Batch {
+        std::vector<std::shared_ptr<UdpTracker>> trackers;
+        std::vector<std::array<unsigned char, 20>> info_hashes;
+    };
+
+    std::unordered_map<std::string, Batch> batches;
+
+    for (const auto& session: _sessions | std::views::values) {
+        for (auto& tracker: session->trackers()) {
+            auto udp = std::dynamic_pointer_cast<UdpTracker>(tracker);
+            if (!udp) continue;
+
+            auto& batch = batches[std::string(udp->url())];
+            batch.trackers.push_back(std::move(udp));
+            batch.info_hashes.push_back(session->info_hash());
+        }
+    }
+
+    // urls no torrent uses anymore, a scrape still running keeps its tracker alive
+    std::erase_if(_scrapers, [&](const auto& entry) { return !batches.contains(entry.first); });
+
+    // trackers are scraped side by side, a dead one waits out its retries without holding up the rest
+    // the client's own tracker sends for every torrent, the sessions' trackers only get the results
+    for (auto& [url, batch]: batches) {
+        auto& scraper = _scrapers[url];
+        if (!scraper) scraper = std::make_shared<UdpTracker>(_ioc.get_executor(), url, batch.info_hashes.front(), nc, _udp_trackers, _dns);
+
+        boost::asio::co_spawn(_ioc, [scraper, batch = std::move(batch)]() -> boost::asio::awaitable<void> {
+            auto results = co_await scraper->scrape(batch.info_hashes);
+            // an unanswered batch keeps what the last scrape found
+            for (size_t i{}; i < results.size(); ++i) if (results[i]) batch.trackers[i]->set_scrape_stats(results[i]);
+        }, boost::asio::detached);
+    }
+}
+
 std::vector<TorrentSnapshot> Client::get_torrent_snapshots() const {
 
     auto out = _sessions 
@@ -88,6 +174,10 @@ std::vector<TrackerSnapshot> Client::get_tracker_snapshots(const std::string& ha
     return _sessions.at(hash)->tracker_snapshots();
 }
 
+std::vector<DiskDeviceStats> Client::get_disk_device_stats() const {
+    return _disk_scheduler.device_stats();
+}
+
 void Client::detect_network_capabilities() {
     nc.ipv6_address = detect_ipv6_address();
     nc.ipv6_outbound = nc.ipv6_address.has_value();
@@ -0,0 +1,118 @@
+#include "DirectStorage.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <print>
+
+namespace {
+    constexpr uint64_t align_down(uint64_t value) { return value & ~(DIRECT_IO_ALIGNMENT - 1); }
+    constexpr uint64_t align_up(uint64_t value) { return align_down(value + DIRECT_IO_ALIGNMENT - 1); }
+
+    // a block past the end of the file reads back as zeros
+    bool read_block(native_handle_t handle, uint64_t offset, std::span<unsigned char> out) {
+        auto n = positional_read_some(handle, offset, out);
+        if (n < 0) return false;
+
+        std::fill(out.begin() + n, out.end(), 0);
+        return true;
+    }
+}
+
+DirectStorage::DirectStorage(FileHandleCache& handles, std::vector<StorageFile> files, AllocationMode allocation):
+    PositionalStorage(handles, std::move(files), allocation, true) {}
+
+bool DirectStorage::write_direct(size_t file_index, native_handle_t handle, uint64_t file_offset, std::span<const std::span<const unsigned char>> buffers) {
+    uint64_t length{};
+    for (auto buffer: buffers) length += buffer.size();
+    if (length == 0) return true;
+
+    const auto end = file_offset + length;
+    const auto first = align_down(file_offset);
+    const auto last = align_up(end);
+
+    std::unique_lock<std::mutex> lock;
+    if (first != file_offset || last != end) lock = std::unique_lock(edge_lock(file_index));
+
+    auto buffer = _buffers.acquire();
+
+    // position in the gathered input
+    size_t index{}, consumed{};
+
+    for (auto chunk = first; chunk < last; chunk += _buffers.buffer_size()) {
+        auto chunk_end = std::min<uint64_t>(last, chunk + _buffers.buffer_size());
+        std::span<unsigned char> out(buffer.get(), chunk_end - chunk);
+
+        // keep what is already on disk around the edges
+        if (chunk < file_offset && !read_block(handle, chunk, out.first(DIRECT_IO_ALIGNMENT))) return false;
+
+        bool tail_shares_head = chunk < file_offset && out.size() == DIRECT_IO_ALIGNMENT;
+        if (chunk_end > end && !tail_shares_head && !read_block(handle, chunk_end - DIRECT_IO_ALIGNMENT, out.last(DIRECT_IO_ALIGNMENT))) return false;
+
+        auto from = std::max(file_offset, chunk);
+        auto to = std::min(end, chunk_end);
+        auto* dst = out.data() + (from - chunk);
+
+        for (auto want = to - from; want > 0;) {
+            auto source = buffers[index];
+            auto take = std::min<uint64_t>(want, source.size() - consumed);
+
+            std::memcpy(dst, source.data() + consumed, take);
+            dst += take;
+            want -= take;
+            consumed += take;
+
+            if (consumed == source.size()) { ++index; consumed = 0; }
+        }
+
+        if (!positional_write(handle, chunk, out)) return false;
+    }
+
+    // the last block of a file is written whole, cut the padding off again
+    const auto file_length = _files[file_index].length;
+    if (last > file_length) return set_file_size(handle, file_length);
+
+    return true;
+}
+
+boost::asio::awaitable<bool> DirectStorage::write_at(size_t file_index, uint64_t file_offset, std::span<const unsigned char> data) {
+    std::span<const unsigned char> buffers[] = { data };
+    co_return co_await write_vectored_at(file_index, file_offset, buffers);
+}
+
+boost::asio::awaitable<bool> DirectStorage::write_vectored_at(size_t file_index, uint64_t file_offset, std::span<const std::span<const unsigned char>> buffers) {
+    auto file = open_for_write(file_index);
+
+    if (!file || !write_direct(file_index, file->handle, file_offset, buffers)) {
+        std::println("Write to {} failed", _files[file_index].path.string());
+        co_return false;
+    }
+
+    co_return true;
+}
+
+boost::asio::awaitable<bool> DirectStorage::read_at(size_t file_index, uint64_t file_offset, std::span<unsigned char> out) {
+    auto file = open_for_read(file_index);
+    if (!file) co_return false;
+
+    auto buffer = _buffers.acquire();
+
+    const auto end = file_offset + out.size();
+    auto* dst = out.data();
+
+    for (auto chunk = align_down(file_offset); chunk < end; chunk += _buffers.buffer_size()) {
+        auto chunk_end = std::min<uint64_t>(align_up(end), chunk + _buffers.buffer_size());
+
+        auto n = positional_read_some(file->handle, chunk, std::span<unsigned char>(buffer.get(), chunk_end - chunk));
+
+        auto from = std::max(file_offset, chunk);
+        auto to = std::min(end, chunk_end);
+
+        // the file ends before the data we were asked for
+        if (n < 0 || chunk + static_cast<uint64_t>(n) < to) co_return false;
+
+        std::memcpy(dst, buffer.get() + (from - chunk), to - from);
+        dst += to - from;
+    }
+
+    co_return true;
+}
@@ -0,0 +1,211 @@
+#include "DiskScheduler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+uint64_t DiskScheduler::device_id(const std::filesystem::path& root) {
+#ifdef _WIN32
+    // the volume the path lives on, covers drive letters and mounted folders alike
+    wchar_t volume[MAX_PATH];
+    if (GetVolumePathNameW(root.c_str(), volume, MAX_PATH)) return std::hash<std::wstring>{}(volume);
+    return 0;
+#else
+    struct stat st{};
+    if (::stat(root.c_str(), &st) == 0) return static_cast<uint64_t>(st.st_dev);
+    return 0;
+#endif
+}
+
+uint32_t DiskScheduler::add_client(const std::filesystem::path& root) {
+    auto device = device_id(root);
+
+    std::lock_guard lock(_mutex);
+
+    auto id = _next_client++;
+    _clients.emplace(id, ClientState{ device });
+    _devices.try_emplace(device);
+
+    return id;
+}
+
+void DiskScheduler::remove_client(uint32_t client) {
+    std::vector<std::move_only_function<void(bool)>> dropped;
+
+    {
+        std::lock_guard lock(_mutex);
+
+        auto it = _clients.find(client);
+        if (it == _clients.end() || it->second.removed) return;
+
+        // the jobs of a client sit together in the queue, (client, offset) is the key
+        auto& queue = _devices[it->second.device].queue;
+        auto first = queue.lower_bound(Position{ client, 0 });
+        auto last = queue.lower_bound(Position{ client + 1, 0 });
+
+        // the session drains its disk work before it goes, see TorrentSession::stop()
+        assert(first == last && it->second.in_flight == 0 && "disk client removed with jobs still queued or running");
+
+        for (auto job = first; job != last; ++job) dropped.push_back(std::move(job->second.wake));
+        queue.erase(first, last);
+
+        if (it->second.in_flight == 0) _clients.erase(it);
+        else {
+            it->second.removed = true;
+            it->second.pending = 0;
+        }
+    }
+
+    // if anything was still waiting it is turned away, its coroutine unwinds instead of being torn down under the awaiter
+    for (auto& wake: dropped) wake(false);
+}
+
+uint64_t DiskScheduler::served(uint32_t client) const {
+    auto it = _clients.find(client);
+    return it == _clients.end() ? 0 : it->second.served;
+}
+
+boost::asio::awaitable<void> DiskScheduler::acquire(DiskJob job) {
+    bool admitted = co_await boost::asio::async_initiate<decltype(boost::asio::use_awaitable), void(bool)>(
+        [this, job](auto handler) {
+            // the slot may be handed out by a release on another thread, resume on the waiter's own executor
+            enqueue(job, [handler = std::move(handler)](bool admitted) mutable {
+                auto exec = boost::asio::get_associated_executor(handler);
+                boost::asio::post(exec, [handler = std::move(handler), admitted]() mutable { std::move(handler)(admitted); });
+            });
+        },
+        boost::asio::use_awaitable
+    );
+
+    if (!admitted) throw std::runtime_error("Disk job for a removed torrent");
+}
+
+void DiskScheduler::enqueue(const DiskJob& job, std::move_only_function<void(bool)> wake) {
+    std::vector<std::move_only_function<void(bool)>> ready;
+    std::unique_lock lock(_mutex);
+
+    // operator[] would bring a removed client back, on device 0
+    auto it = _clients.find(job.client);
+    if (it == _clients.end() || it->second.removed) {
+        lock.unlock();
+        wake(false);
+        return;
+    }
+
+    auto& client = it->second;
+    auto& device = _devices[client.device];
+
+    // a torrent coming back from idle starts level with the busiest one, not with a backlog of credit
+    if (client.pending++ == 0) {
+        uint64_t floor = std::numeric_limits<uint64_t>::max();
+        for (const auto& [id, other]: _clients) {
+            if (other.device == client.device && other.pending > 0 && id != job.client) floor = std::min(floor, other.served);
+        }
+        if (floor != std::numeric_limits<uint64_t>::max()) client.served = std::max(client.served, floor);
+    }
+
+    device.queue.emplace(Position{ job.client, job.offset }, Pending{ job.kind, job.bytes, std::chrono::steady_clock::now(), std::move(wake) });
+    dispatch(device, ready);
+
+    lock.unlock();
+    for (auto& ready_wake: ready) ready_wake(true);
+}
+
+void DiskScheduler::release(const DiskJob& job) {
+    std::vector<std::move_only_function<void(bool)>> ready;
+
+    {
+        std::lock_guard lock(_mutex);
+
+        // a removed client is kept until now, its device still has to get the slot back
+        auto it = _clients.find(job.client);
+        if (it == _clients.end()) return;
+
+        auto& device = _devices[it->second.device];
+        --device.in_flight;
+
+        if (--it->second.in_flight == 0 && it->second.removed) _clients.erase(it);
+
+        dispatch(device, ready);
+    }
+
+    for (auto& wake: ready) wake(true);
+}
+
+void DiskScheduler::dispatch(Device& device, std::vector<std::move_only_function<void(bool)>>& ready) {
+    while (device.in_flight < _jobs_per_device && !device.queue.empty()) {
+        auto it = pick(device);
+
+        if (auto client = _clients.find(it->first.first); client != _clients.end()) {
+            client->second.served += it->second.bytes;
+            --client->second.pending;
+            ++client->second.in_flight;
+        }
+
+        device.head = it->first;
+        ++device.in_flight;
+
+        ready.push_back(std::move(it->second.wake));
+        device.queue.erase(it);
+    }
+}
+
+std::multimap<DiskScheduler::Position, DiskScheduler::Pending>::iterator DiskScheduler::pick(Device& device) {
+    auto now = std::chrono::steady_clock::now();
+    auto end = device.queue.end();
+
+    auto overdue_read = end, overdue = end;
+    uint64_t min_served = std::numeric_limits<uint64_t>::max();
+
+    for (auto it = device.queue.begin(); it != end; ++it) {
+        const auto& job = it->second;
+        auto waited = now - job.queued;
+
+        if (job.kind == DiskJobKind::Read && waited >= READ_LATENCY_BOUND && (overdue_read == end || job.queued < overdue_read->second.queued)) overdue_read = it;
+        if (waited >= DEADLINE && (overdue == end || job.queued < overdue->second.queued)) overdue = it;
+
+        min_served = std::min(min_served, served(it->first.first));
+    }
+
+    if (overdue_read != end) return overdue_read;
+    if (overdue != end) return overdue;
+
+    auto fair = [&](const auto& it) { return served(it->first.first) <= min_served + FAIR_QUANTUM; };
+
+    // continue the sweep from the last position handed out, then wrap around to the start
+    auto start = device.queue.lower_bound(device.head);
+
+    for (auto it = start; it != end; ++it) if (fair(it)) return it;
+    for (auto it = device.queue.begin(); it != start; ++it) if (fair(it)) return it;
+
+    // the least served torrent is always fair, so this is never reached
+    return device.queue.begin();
+}
+
+size_t DiskScheduler::pending(uint32_t client) const {
+    std::lock_guard lock(_mutex);
+
+    auto it = _clients.find(client);
+    return it == _clients.end() ? 0 : it->second.pending;
+}
+
+std::vector<DiskDeviceStats> DiskScheduler::device_stats() const {
+    std::lock_guard lock(_mutex);
+
+    std::vector<DiskDeviceStats> out;
+    out.reserve(_devices.size());
+
+    for (const auto& [id, device]: _devices) out.push_back({ id, device.queue.size(), device.in_flight });
+    return out;
+}
@@ -0,0 +1,60 @@
+#include "DiskStats.hpp"
+
+#include <algorithm>
+#include <bit>
+
+void LatencyHistogram::record(std::chrono::steady_clock::duration elapsed) {
+    auto us = static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+    auto bucket = std::min<size_t>(std::bit_width(us), BUCKETS - 1);
+
+    _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _total_us.fetch_add(us, std::memory_order_relaxed);
+
+    auto max = _max_us.load(std::memory_order_relaxed);
+    while (us > max && !_max_us.compare_exchange_weak(max, us, std::memory_order_relaxed)) {}
+}
+
+// percentiles are the upper edge of the bucket they fall in, good to a factor of two
+LatencySnapshot LatencyHistogram::snapshot() const {
+    LatencySnapshot out;
+    out.buckets.resize(BUCKETS);
+
+    for (size_t i{}; i < BUCKETS; ++i) {
+        out.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+        out.count += out.buckets[i];
+    }
+
+    out.max_us = _max_us.load(std::memory_order_relaxed);
+    if (out.count == 0) return out;
+
+    out.mean_us = _total_us.load(std::memory_order_relaxed) / out.count;
+
+    auto percentile = [&](uint64_t rank) {
+        uint64_t seen{};
+        for (size_t i{}; i < BUCKETS; ++i) {
+            seen += out.buckets[i];
+            if (seen >= rank) return std::min<uint64_t>(out.max_us, (uint64_t(1) << i) - 1);
+        }
+        return out.max_us;
+    };
+
+    out.p50_us = percentile((out.count + 1) / 2);
+    out.p99_us = percentile(out.count - out.count / 100);
+
+    return out;
+}
+
+DiskStatsSnapshot DiskStats::snapshot() const {
+    DiskStatsSnapshot out;
+
+    out.read = read.snapshot();
+    out.write = write.snapshot();
+    out.hash = hash.snapshot();
+    out.queue_wait = queue_wait.snapshot();
+
+    out.bytes_read = bytes_read.load(std::memory_order_relaxed);
+    out.bytes_written = bytes_written.load(std::memory_order_relaxed);
+
+    return out;
+}
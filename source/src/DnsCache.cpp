@@ -0,0 +1,80 @@
+#include "DnsCache.hpp"
+#include "NetworkCapabilities.hpp"
+
+#include <algorithm>
+
+#include <boost/asio/experimental/awaitable_operators.hpp>
+
+namespace net = boost::asio;
+using namespace boost::asio::experimental::awaitable_operators;
+
+DnsCache::DnsCache(boost::asio::any_io_executor exec, const NetworkCapabilities& nc): _strand(net::make_strand(exec)), _nc(nc) {}
+
+boost::asio::awaitable<std::shared_ptr<const DnsEntry>> DnsCache::lookup(std::string host) {
+    boost::system::error_code ec;
+    auto literal = net::ip::make_address(host, ec);
+
+    if (!ec) {
+        auto entry = std::make_shared<DnsEntry>();
+        (literal.is_v4() ? entry->v4 : entry->v6).push_back(literal);
+        co_return entry;
+    }
+
+    co_return co_await net::co_spawn(_strand, do_lookup(std::move(host)), net::use_awaitable);
+}
+
+boost::asio::awaitable<std::shared_ptr<const DnsEntry>> DnsCache::do_lookup(std::string host) {
+    auto now = std::chrono::steady_clock::now();
+
+    if (auto& slot = _cache[host]; slot.entry && now < slot.entry->expires) co_return slot.entry;
+
+    // someone else is looking it up already, take whatever they get
+    if (auto resolving = _cache[host].resolving) {
+        boost::system::error_code ec;
+        co_await resolving->async_wait(net::redirect_error(net::use_awaitable, ec));
+        co_return _cache[host].entry;
+    }
+
+    auto resolving = std::make_shared<net::steady_timer>(_strand, net::steady_timer::time_point::max());
+    _cache[host].resolving = resolving;
+
+    auto entry = std::make_shared<DnsEntry>();
+    boost::system::error_code ec4, ec6;
+
+    // both families at once, a slow AAAA answer shouldn't hold up the A records
+    if (_nc.ipv4_outbound && _nc.ipv6_outbound) {
+        std::tie(entry->v4, entry->v6) = co_await (resolve(host, net::ip::tcp::v4(), ec4) && resolve(host, net::ip::tcp::v6(), ec6));
+    }
+    else if (_nc.ipv4_outbound) entry->v4 = co_await resolve(host, net::ip::tcp::v4(), ec4);
+    else if (_nc.ipv6_outbound) entry->v6 = co_await resolve(host, net::ip::tcp::v6(), ec6);
+
+    bool found = !entry->v4.empty() || !entry->v6.empty();
+    entry->ec = found ? boost::system::error_code{} : ec4 ? ec4 : ec6 ? ec6 : net::error::host_not_found;
+    entry->expires = std::chrono::steady_clock::now() + (found ? POSITIVE_TTL : NEGATIVE_TTL);
+
+    if (_cache.size() > PRUNE_SIZE) {
+        std::erase_if(_cache, [now](const auto& item) { return !item.second.resolving && (!item.second.entry || item.second.entry->expires <= now); });
+    }
+
+    auto& slot = _cache[host];
+    slot.entry = entry;
+    slot.resolving.reset();
+    resolving->cancel();
+
+    co_return entry;
+}
+
+boost::asio::awaitable<std::vector<boost::asio::ip::address>> DnsCache::resolve(const std::string& host, boost::asio::ip::tcp protocol, boost::system::error_code& ec) {
+    net::ip::tcp::resolver resolver(_strand);
+    std::vector<net::ip::address> out;
+
+    auto results = co_await resolver.async_resolve(protocol, host, "", net::redirect_error(net::use_awaitable, ec));
+    if (ec) co_return out;
+
+    for (const auto& r: results) {
+        auto addr = r.endpoint().address();
+        if (std::ranges::find(out, addr) == out.end()) out.push_back(addr);
+    }
+
+    co_return out;
+}
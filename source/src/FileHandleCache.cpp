@@ -0,0 +1,82 @@
+#include "FileHandleCache.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// leave most of the descriptor limit to sockets
+size_t FileHandleCache::default_capacity() {
+#ifdef _WIN32
+    return 1024;
+#else
+    rlimit limit{};
+    if (::getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) return 1024;
+
+    return std::clamp<size_t>(static_cast<size_t>(limit.rlim_cur) / 4, 32, 4096);
+#endif
+}
+
+std::shared_ptr<FileHandle> FileHandleCache::open(const std::filesystem::path& path, bool write, bool direct) {
+    const auto& key = path.native();
+
+    // handles are closed outside the lock, the last reference may be the one we drop here
+    std::vector<std::shared_ptr<FileHandle>> evicted;
+    std::shared_ptr<FileHandle> file;
+
+    {
+        std::lock_guard lock(_mutex);
+
+        auto it = _entries.find(key);
+        if (it != _entries.end()) {
+            _lru.splice(_lru.begin(), _lru, it->second.lru);
+            const auto& current = *it->second.file;
+            if ((!write || current.writable) && current.direct == direct) return it->second.file;
+
+            // reopen, whoever still holds the old handle finishes with it
+            evicted.push_back(std::move(it->second.file));
+            _lru.erase(it->second.lru);
+            _entries.erase(it);
+        }
+
+        auto handle = open_native(path, write, direct);
+        if (handle == invalid_native_handle) return nullptr;
+
+        file = std::make_shared<FileHandle>(handle, write, direct);
+
+        _lru.push_front(key);
+        _entries.emplace(key, Entry{ file, _lru.begin() });
+
+        while (_entries.size() > _capacity) {
+            auto victim = _entries.find(_lru.back());
+            evicted.push_back(std::move(victim->second.file));
+
+            _entries.erase(victim);
+            _lru.pop_back();
+        }
+    }
+
+    return file;
+}
+
+void FileHandleCache::close(const std::filesystem::path& path) {
+    std::shared_ptr<FileHandle> file;
+
+    {
+        std::lock_guard lock(_mutex);
+
+        auto it = _entries.find(path.native());
+        if (it == _entries.end()) return;
+
+        file = std::move(it->second.file);
+        _lru.erase(it->second.lru);
+        _entries.erase(it);
+    }
+}
+
+size_t FileHandleCache::size() const {
+    std::lock_guard lock(_mutex);
+    return _entries.size();
+}
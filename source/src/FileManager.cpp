@@ -1,117 +1,441 @@
 #include "FileManager.hpp"
 #include "MetadataParser.hpp"
+#include "StorageFactory.hpp"
+#include "ResumeData.hpp"
+#include "NativeFile.hpp"
 
 #include <boost/asio.hpp>
 
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    ResumeFileState file_state(const std::filesystem::path& path) {
+        std::error_code ec;
+
+        auto size = std::filesystem::file_size(path, ec);
+        if (ec) return { 0, 0 };
+
+        auto mtime = std::filesystem::last_write_time(path, ec);
+        if (ec) return { size, 0 };
+
+        return { size, static_cast<int64_t>(mtime.time_since_epoch().count()) };
+    }
+}
+
 // make a list of output files with offsets
-void FileManager::build_output_files(std::filesystem::path root, std::string_view torrent_name, std::vector<TorrentFile>& file_list, uint64_t total_size) {
+// nothing is touched on disk here, the storage creates and allocates each file on the disk executor the first time it is written
+void FileManager::build_output_files(boost::asio::any_io_executor disk_exec, FileHandleCache& handles, std::filesystem::path root, std::string_view torrent_name, std::vector<TorrentFile>& file_list, uint64_t total_size, StorageMode mode, AllocationMode allocation) {
     uint64_t offset{};
 
     auto base = root / torrent_name;
 
-    if (file_list.empty()) {
-        OutputFile out = { std::fstream(base), total_size, 0 };
-        output_files.push_back(std::move(out));
-    }
+    std::vector<StorageFile> output_files;
+
+    if (file_list.empty()) output_files.push_back({ base, total_size, 0 });
 
     for (const auto& file: file_list) {
-        auto path = base / file.path;
+        output_files.push_back({ base / file.path, file.length, offset, file.pad });
 
-        std::filesystem::create_directories(path.parent_path());
+        offset += file.length;
+    }
 
-        if (!std::filesystem::exists(path)) std::ofstream(path, std::ios::binary).close();
+    _storage = make_storage(disk_exec, handles, mode, allocation, std::move(output_files));
 
-        std::filesystem::resize_file(path, file.length);
+    _total_size = file_list.empty() ? total_size : offset;
+    _num_pieces = static_cast<uint32_t>((_total_size + standard_piece_length - 1) / standard_piece_length);
+    _completed.resize((_num_pieces + 7) / 8);
 
-        OutputFile out;
-        out.length = file.length;
-        out.offset = offset;
-        out.handle.open(path, std::ios::binary | std::ios::in | std::ios::out);
+    _resume_path = root / (std::string(torrent_name) + ".fastresume");
+}
 
-        output_files.emplace_back(std::move(out));
+// pieces are only marked complete once flushed, a crash loses cached pieces but never claims them
+boost::asio::awaitable<void> FileManager::write_piece(uint32_t piece, std::vector<unsigned char> data) {
+    uint64_t piece_offset = uint64_t(piece) * standard_piece_length;
+    uint64_t size = data.size();
 
-        offset += file.length;
+    {
+        std::lock_guard lock(_cache_mutex);
+        _cache.insert_or_assign(piece_offset, CachedPiece{ piece, std::move(data) });
     }
 
-    auto savefile_path = root / (std::string(torrent_name) + ".fastresume");
-    if (!std::filesystem::exists(savefile_path)) std::ofstream(savefile_path, std::ios::binary).close();
-    savefile.open(savefile_path, std::ios::binary | std::ios::in | std::ios::out | std::ios::app);
+    auto cached = _cached_bytes.fetch_add(size) + size;
+    if (cached >= _cache_config.budget_bytes) co_await flush();
+
+    // whatever is left below the budget, or arrived during the flush, still goes out by the deadline
+    schedule_flush();
 }
 
-boost::asio::awaitable<void> FileManager::write_piece(uint32_t piece, std::vector<unsigned char> data) {
+void FileManager::schedule_flush() {
+    {
+        std::lock_guard lock(_cache_mutex);
+        if (_flush_scheduled || _closing || _cache.empty()) return;
+        _flush_scheduled = true;
+    }
 
-    uint64_t piece_offset = uint64_t(piece) * standard_piece_length;
-    uint64_t remaining = data.size();
-    uint64_t data_offset = 0;
+    boost::asio::co_spawn(_flush_strand, flush_after_deadline(), boost::asio::detached);
+}
 
-    auto start = std::ranges::upper_bound(output_files, piece_offset, {}, &OutputFile::offset);
-    if (start != output_files.begin()) start = prev(start);
+// runs on _flush_strand, the flag stays set until it returns so close() knows to wait for it
+boost::asio::awaitable<void> FileManager::flush_after_deadline() {
+    auto closing = [this] { std::lock_guard lock(_cache_mutex); return _closing; };
 
-    while (remaining > 0) {
-        uint64_t file_offset = piece_offset > start->offset ? piece_offset - start->offset : 0;
-        uint64_t write_size = std::min(remaining, start->length - file_offset);
-        
-        start->handle.seekp(file_offset);
-        start->handle.write(reinterpret_cast<const char*>(data.data() + data_offset), write_size);
+    boost::system::error_code ec;
 
-        remaining -= write_size;
-        data_offset += write_size;
-        piece_offset += write_size;
+    // close() may have cancelled the timer before we got to wait on it
+    if (!closing()) {
+        _flush_timer.expires_after(_cache_config.flush_deadline);
+        co_await _flush_timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    }
 
-        if (remaining == 0) break;
+    if (!ec && !closing()) {
+        try {
+            co_await flush();
+        }
+        catch (const std::exception& e) {
+            std::println("Flush failed: {}", e.what());
+        }
+    }
 
-        start = next(start);
-        assert(start != output_files.end() && "https://en.cppreference.com/cpp/algorithm/ranges/upper_bound");
+    {
+        std::lock_guard lock(_cache_mutex);
+        _flush_scheduled = false;
     }
+    _flush_done.cancel();
 
-    mark_complete(piece);
-    co_return;
+    // pieces cached while we were writing wait for the next deadline
+    schedule_flush();
 }
 
-boost::asio::awaitable<std::optional<std::vector<unsigned char>>> FileManager::read_block(uint32_t piece, uint32_t begin, uint32_t length) {
-    std::vector<unsigned char> buffer(length);
+boost::asio::awaitable<void> FileManager::close() {
+    co_await boost::asio::co_spawn(_flush_strand, [this]() -> boost::asio::awaitable<void> {
+        {
+            std::lock_guard lock(_cache_mutex);
+            _closing = true;
+        }
+        _flush_timer.cancel();
 
-    uint64_t piece_offset = uint64_t(piece) * standard_piece_length + begin;
-    uint64_t remaining = length;
-    uint64_t data_offset = 0;
+        for (;;) {
+            {
+                std::lock_guard lock(_cache_mutex);
+                if (!_flush_scheduled) break;
+            }
+
+            _flush_done.expires_at(boost::asio::steady_timer::time_point::max());
+
+            boost::system::error_code ec;
+            co_await _flush_done.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        }
+    }, boost::asio::use_awaitable);
+
+    co_await flush();
+}
 
-    auto start = std::ranges::upper_bound(output_files, piece_offset, {}, &OutputFile::offset);
-    if (start != output_files.begin()) start = prev(start);
+boost::asio::awaitable<void> FileManager::flush() {
+    std::vector<std::pair<uint64_t, const CachedPiece*>> batch;
 
-    while (remaining > 0) {
+    {
+        std::lock_guard lock(_cache_mutex);
+        batch.reserve(_cache.size());
 
-        uint64_t file_offset = piece_offset > start->offset ? piece_offset - start->offset : 0;
-        uint64_t read_size = std::min(remaining, start->length - file_offset);
+        // nodes keep their address when moved between maps, and nobody else touches them until we erase them
+        for (auto& [offset, cached]: _cache) batch.emplace_back(offset, &cached);
+        _flushing.merge(_cache);
+    }
+
+    bool failed = false;
+
+    size_t i = 0;
+    while (i < batch.size()) {
+        auto run_start = batch[i].first;
+        auto run_end = run_start;
+
+        std::vector<std::span<const unsigned char>> buffers;
+        size_t first = i;
+
+        // merge pieces that sit back to back into one gathered write
+        while (i < batch.size() && batch[i].first == run_end) {
+            const auto& data = batch[i].second->data;
+            buffers.emplace_back(data);
+            run_end += data.size();
+            ++i;
+        }
+
+        DiskJob job{ _disk_client, DiskJobKind::Write, run_start, run_end - run_start };
+
+        bool ok;
+
+        co_await acquire_disk(job);
+        {
+            ScopedLatency timer(_stats.write);
+            ok = co_await _storage->write_vectored(run_start, buffers);
+        }
+        _scheduler.release(job);
+
+        // nothing in a run that failed is claimed, it goes back into the cache for the next flush to try again
+        if (!ok) {
+            std::lock_guard lock(_cache_mutex);
+
+            for (size_t j = first; j < i; ++j) {
+                auto node = _flushing.extract(batch[j].first);
+                auto size = node.mapped().data.size();
+
+                // a newer copy of the piece was cached in the meantime, it wins
+                if (!_cache.insert(std::move(node)).inserted) _cached_bytes.fetch_sub(size);
+            }
+
+            failed = true;
+            continue;
+        }
+
+        _stats.bytes_written.fetch_add(run_end - run_start, std::memory_order_relaxed);
+
+        uint64_t written{};
+        for (size_t j = first; j < i; ++j) {
+            mark_complete(batch[j].second->piece);
+            written += batch[j].second->data.size();
+        }
+
+        {
+            std::lock_guard lock(_cache_mutex);
+            for (size_t j = first; j < i; ++j) _flushing.erase(batch[j].first);
+        }
 
-        start->handle.seekg(file_offset);
-        start->handle.read(reinterpret_cast<char*>(buffer.data() + data_offset), read_size);
+        _cached_bytes.fetch_sub(written);
+    }
+
+    if (failed) schedule_flush();
+}
 
-        remaining   -= read_size;
-        data_offset += read_size;
-        piece_offset += read_size;
+// a piece we have announced can be requested before it reaches the disk
+std::optional<std::vector<unsigned char>> FileManager::read_from_cache(uint32_t piece, uint32_t begin, uint32_t length) {
+    uint64_t piece_offset = uint64_t(piece) * standard_piece_length;
 
-        if (remaining == 0) break;
+    std::lock_guard lock(_cache_mutex);
 
-        start = next(start);
-        assert(start != output_files.end() && "https://en.cppreference.com/cpp/algorithm/ranges/upper_bound");
+    auto it = _cache.find(piece_offset);
+    if (it == _cache.end()) {
+        it = _flushing.find(piece_offset);
+        if (it == _flushing.end()) return std::nullopt;
     }
 
+    const auto& data = it->second.data;
+    if (uint64_t(begin) + length > data.size()) return std::nullopt;
+
+    return std::vector<unsigned char>(data.begin() + begin, data.begin() + begin + length);
+}
+
+boost::asio::awaitable<void> FileManager::acquire_disk(const DiskJob& job) {
+    ScopedLatency wait(_stats.queue_wait);
+    co_await _scheduler.acquire(job);
+}
+
+boost::asio::awaitable<std::optional<std::vector<unsigned char>>> FileManager::read_block(uint32_t piece, uint32_t begin, uint32_t length) {
+    ScopedLatency timer(_stats.read);
+
+    if (auto cached = read_from_cache(piece, begin, length)) co_return cached;
+
+    std::vector<unsigned char> buffer(length);
+
+    uint64_t piece_offset = uint64_t(piece) * standard_piece_length + begin;
+
+    DiskJob job{ _disk_client, DiskJobKind::Read, piece_offset, length };
+
+    co_await acquire_disk(job);
+    bool ok = co_await _storage->read(piece_offset, buffer);
+    _scheduler.release(job);
+
+    if (!ok) co_return std::nullopt;
+
+    _stats.bytes_read.fetch_add(length, std::memory_order_relaxed);
     co_return buffer;
 }
 
-std::vector<uint32_t> FileManager::read_save_file() {
-    // use a bitset for less space
-    std::vector<uint32_t> out;
-    uint32_t piece;
+ResumeState FileManager::load_resume() {
+    ResumeState out;
+
+    std::ifstream in(_resume_path, std::ios::binary);
+    if (!in) return out;
+
+    std::vector<unsigned char> raw((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+
+    bool rewrite = false;
+    std::vector<uint8_t> bitfield((_num_pieces + 7) / 8);
+    std::vector<bool> invalid(_num_pieces, false);
+
+    auto set = [&](uint32_t piece) { bitfield[piece / 8] |= (1 << (7 - (piece % 8))); };
+
+    auto resume = parse_resume(raw);
+    bool legacy = !resume && raw.size() % 4 == 0 && !(raw.size() >= 4 && std::memcmp(raw.data(), "CTRS", 4) == 0);
+
+    // a resume file for a different layout, or a corrupt one, is worth nothing
+    if (resume && (resume->num_pieces != _num_pieces || resume->piece_length != standard_piece_length)) resume.reset();
+    if (!resume && !legacy) rewrite = true;
+
+    if (resume) {
+        bitfield = resume->bitfield;
+
+        const auto& files = _storage->files();
+        bool files_match = resume->files.size() == files.size();
+
+        for (size_t i{}; i < files.size(); ++i) {
+            const auto& file = files[i];
+            if (file.length == 0 || file.pad) continue;
+
+            auto now = file_state(file.path);
+            if (files_match && now.size == resume->files[i].size && now.mtime == resume->files[i].mtime) continue;
+
+            // file was touched outside of a session, its pieces only count again once they hash
+            // the file is left unsaved, a crash before the check ends just runs it again next time
+            auto first = static_cast<uint32_t>(file.offset / standard_piece_length);
+            auto last = static_cast<uint32_t>((file.offset + file.length - 1) / standard_piece_length);
 
-    savefile.clear();
-    savefile.seekg(0, std::ios::beg);
-    while (savefile.read(reinterpret_cast<char*>(&piece), sizeof(piece))) out.push_back(piece);
+            for (auto piece = first; piece <= last; ++piece) {
+                if (!invalid[piece] && resume->has_piece(piece)) out.recheck.push_back(piece);
 
-    savefile.clear();
+                bitfield[piece / 8] &= ~(1 << (7 - (piece % 8)));
+                invalid[piece] = true;
+            }
+        }
+
+        for (auto& partial: resume->partial) {
+            if (!invalid[partial.piece] && !resume->has_piece(partial.piece)) out.partial.push_back(std::move(partial));
+        }
+    }
+    else if (legacy) {
+        // legacy append log of raw piece indices, trusted once and rewritten in the new format
+        for (size_t i{}; i + 4 <= raw.size(); i += 4) {
+            uint32_t piece;
+            std::memcpy(&piece, raw.data() + i, 4);
+            if (piece < _num_pieces) set(piece);
+        }
+        rewrite = true;
+    }
+
+    for (uint32_t piece{}; piece < _num_pieces; ++piece) {
+        if ((bitfield[piece / 8] >> (7 - (piece % 8))) & 1) out.completed.push_back(piece);
+    }
+
+    {
+        std::lock_guard lock(_resume_mutex);
+        _completed = std::move(bitfield);
+        _completed_count = static_cast<uint32_t>(out.completed.size());
+        for (const auto& partial: out.partial) _partial[partial.piece] = partial.blocks;
+    }
+
+    if (rewrite) write_resume();
     return out;
 }
 
 void FileManager::mark_complete(uint32_t piece) {
-    savefile.write(reinterpret_cast<const char*>(&piece), sizeof(piece));
-}
\ No newline at end of file
+    bool save = false, finished = false;
+
+    {
+        std::lock_guard lock(_resume_mutex);
+        if (!((_completed[piece / 8] >> (7 - (piece % 8))) & 1)) ++_completed_count;
+
+        _completed[piece / 8] |= (1 << (7 - (piece % 8)));
+        _partial.erase(piece);
+        _unpersisted.erase(piece);
+        save = ++_unsaved_completions >= SAVE_EVERY;
+
+        // empty files hold no pieces and are never written, create them once everything else is in place
+        finished = _completed_count == _num_pieces && !_empty_files_created;
+        if (finished) _empty_files_created = true;
+    }
+
+    if (finished) _storage->create_empty_files();
+    if (save || finished) write_resume();
+}
+
+boost::asio::awaitable<void> FileManager::save_resume() {
+    bool dirty;
+    {
+        std::lock_guard lock(_resume_mutex);
+        dirty = _unsaved_completions > 0;
+    }
+
+    if (dirty) write_resume();
+    co_return;
+}
+
+boost::asio::awaitable<void> FileManager::save_partial(std::vector<PartialPieceWrite> pieces) {
+    {
+        std::lock_guard lock(_resume_mutex);
+        if (pieces.empty() && _partial.empty()) co_return;
+    }
+
+    for (const auto& partial: pieces) {
+        uint64_t piece_offset = uint64_t(partial.piece) * standard_piece_length;
+
+        for (const auto& [begin, data]: partial.unwritten) {
+            DiskJob job{ _disk_client, DiskJobKind::Write, piece_offset + begin, data.size() };
+
+            bool ok;
+
+            co_await acquire_disk(job);
+            {
+                ScopedLatency timer(_stats.write);
+                ok = co_await _storage->write(piece_offset + begin, data);
+            }
+            _scheduler.release(job);
+
+            if (ok) _stats.bytes_written.fetch_add(data.size(), std::memory_order_relaxed);
+
+            // the piece manager counts the block as persisted either way, so a failure is remembered here
+            auto block = begin / PARTIAL_BLOCK_SIZE;
+            uint8_t bit = 1 << (7 - (block % 8));
+
+            std::lock_guard lock(_resume_mutex);
+            auto& unpersisted = _unpersisted[partial.piece];
+            unpersisted.resize(partial.blocks.size());
+
+            if (ok) unpersisted[block / 8] &= ~bit;
+            else unpersisted[block / 8] |= bit;
+        }
+    }
+
+    {
+        std::lock_guard lock(_resume_mutex);
+
+        // the set replaces the previous one, pieces that finished or failed their hash since drop out
+        _partial.clear();
+        for (auto& partial: pieces) {
+            if ((_completed[partial.piece / 8] >> (7 - (partial.piece % 8))) & 1) continue;
+
+            // blocks that never made it to disk are left out, they are downloaded again after a restart
+            if (auto it = _unpersisted.find(partial.piece); it != _unpersisted.end()) {
+                for (size_t i{}; i < partial.blocks.size() && i < it->second.size(); ++i) partial.blocks[i] &= ~it->second[i];
+                if (std::ranges::all_of(it->second, [](uint8_t byte) { return byte == 0; })) _unpersisted.erase(it);
+            }
+
+            _partial[partial.piece] = std::move(partial.blocks);
+        }
+    }
+
+    write_resume();
+}
+
+// the data has to be durable before the resume file claims it, so sync first and commit after
+void FileManager::write_resume() {
+    std::lock_guard save_lock(_save_mutex);
+
+    ResumeData data;
+    data.num_pieces = _num_pieces;
+    data.piece_length = standard_piece_length;
+
+    {
+        std::lock_guard lock(_resume_mutex);
+        data.bitfield = _completed;
+        for (const auto& [piece, blocks]: _partial) data.partial.push_back({ piece, blocks });
+        _unsaved_completions = 0;
+    }
+
+    _storage->sync();
+
+    for (const auto& file: _storage->files()) data.files.push_back(file_state(file.path));
+
+    auto bytes = serialize_resume(data);
+    if (!write_file_atomic(_resume_path, bytes)) std::println("Could not write {}", _resume_path.string());
+}
@@ -0,0 +1,215 @@
+#include "HttpConnectionPool.hpp"
+#include "DnsCache.hpp"
+
+#include <ranges>
+
+namespace net = boost::asio;
+namespace ssl = boost::asio::ssl;
+namespace http = boost::beast::http;
+
+namespace {
+    // the same for both kinds of connection, only the stream type differs
+    template <typename AsyncStream>
+    boost::asio::awaitable<void> exchange(AsyncStream& stream, boost::beast::flat_buffer& buffer, HttpConnectionPool::Request& req, HttpConnectionPool::Response& res, boost::system::error_code& ec) {
+        co_await http::async_write(stream, req, net::redirect_error(net::use_awaitable, ec));
+        if (!ec) co_await http::async_read(stream, buffer, res, net::redirect_error(net::use_awaitable, ec));
+    }
+}
+
+HttpConnectionPool::HttpConnectionPool(boost::asio::any_io_executor exec, DnsCache& dns): _exec(exec), _dns(dns), _ssl_ctx(ssl::context::tlsv12_client), _sweep_timer(exec) {
+    // keep the sessions openssl hands us, resumption is done by hand per host in connect()
+    SSL_CTX_set_session_cache_mode(_ssl_ctx.native_handle(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+}
+
+// openssl throws away the session of a connection freed without a close_notify, say it was shut down cleanly instead
+// an idle connection is simply dropped, sending close_notify first would only cost a write nobody waits for
+HttpConnectionPool::Connection::~Connection() {
+    if (tls && healthy) SSL_set_shutdown(tls->native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+}
+
+HttpConnectionPool::~HttpConnectionPool() {
+    for (auto* session: _sessions | std::views::values) SSL_SESSION_free(session);
+}
+
+boost::asio::awaitable<HttpConnectionPool::Result> HttpConnectionPool::request(bool tls, std::string host, uint16_t port, Request req, const void* owner) {
+    auto key = (tls ? "https://" : "http://") + host + ":" + std::to_string(port);
+    req.keep_alive(true);
+
+    Result out;
+
+    for (int attempt{}; attempt < 2; ++attempt) {
+        auto conn = take_idle(key);
+        bool reused = conn != nullptr;
+
+        out.ec = {};
+        if (!conn) conn = co_await connect(tls, key, host, port, owner, out.ec);
+        if (out.ec) co_return out;
+
+        set_active(owner, conn.get(), true);
+
+        out.response = {};
+        if (conn->tls) co_await exchange(*conn->tls, conn->buffer, req, out.response, out.ec);
+        else co_await exchange(*conn->plain, conn->buffer, req, out.response, out.ec);
+
+        set_active(owner, conn.get(), false);
+        conn->healthy = !out.ec;
+
+        // the server closed a connection that sat idle, the request never got to it
+        bool closed_early = out.ec == http::error::end_of_stream || out.ec == ssl::error::stream_truncated;
+        bool closed_while_idle = closed_early || out.ec == net::error::connection_reset || out.ec == net::error::broken_pipe;
+        if (reused && closed_while_idle && attempt == 0) continue;
+
+        // sometimes trackers behave badly, like closing the stream before the response is complete
+        // tolerate it and try to parse what they send, the connection is done either way
+        // a reset or broken pipe on a fresh connection is a real network error and is reported as one
+        if (closed_early && !reused) {
+            out.ec = {};
+            co_return out;
+        }
+
+        if (!out.ec) {
+            if (conn->tls) save_session(key, *conn->tls);
+            if (out.response.keep_alive()) release(std::move(conn));
+        }
+
+        co_return out;
+    }
+
+    co_return out;
+}
+
+void HttpConnectionPool::cancel(const void* owner) {
+    std::lock_guard lock(_mutex);
+
+    auto [first, last] = _active.equal_range(owner);
+    for (auto it = first; it != last; ++it) {
+        boost::system::error_code ec;
+        it->second->socket().cancel(ec);
+        it->second->socket().close(ec);
+    }
+}
+
+void HttpConnectionPool::set_active(const void* owner, Connection* conn, bool active) {
+    std::lock_guard lock(_mutex);
+
+    if (active) {
+        _active.emplace(owner, conn);
+        return;
+    }
+
+    auto [first, last] = _active.equal_range(owner);
+    for (auto it = first; it != last; ++it) if (it->second == conn) { _active.erase(it); break; }
+}
+
+boost::asio::awaitable<std::unique_ptr<HttpConnectionPool::Connection>> HttpConnectionPool::connect(bool tls, const std::string& key, const std::string& host, uint16_t port, const void* owner, boost::system::error_code& ec) {
+    auto entry = co_await _dns.lookup(host);
+
+    ec = entry->ec;
+    if (ec) co_return nullptr;
+
+    std::vector<tcp::endpoint> endpoints;
+    for (const auto& addr: entry->v4) endpoints.emplace_back(addr, port);
+    for (const auto& addr: entry->v6) endpoints.emplace_back(addr, port);
+
+    auto conn = std::make_unique<Connection>();
+    conn->key = key;
+
+    if (tls) {
+        conn->tls = std::make_unique<TlsStream>(_exec, _ssl_ctx);
+
+        if (!SSL_set_tlsext_host_name(conn->tls->native_handle(), host.c_str())) {
+            ec = net::error::invalid_argument;
+            co_return nullptr;
+        }
+
+        std::lock_guard lock(_mutex);
+        auto it = _sessions.find(key);
+        if (it != _sessions.end()) SSL_set_session(conn->tls->native_handle(), it->second);
+    }
+    else conn->plain = std::make_unique<tcp::socket>(_exec);
+
+    set_active(owner, conn.get(), true);
+
+    co_await net::async_connect(conn->socket(), endpoints, net::redirect_error(net::use_awaitable, ec));
+    if (!ec && tls) co_await conn->tls->async_handshake(ssl::stream_base::client, net::redirect_error(net::use_awaitable, ec));
+
+    set_active(owner, conn.get(), false);
+
+    if (ec) co_return nullptr;
+    co_return conn;
+}
+
+std::unique_ptr<HttpConnectionPool::Connection> HttpConnectionPool::take_idle(const std::string& key) {
+    std::lock_guard lock(_mutex);
+
+    auto it = _idle.find(key);
+    if (it == _idle.end()) return nullptr;
+
+    auto now = std::chrono::steady_clock::now();
+    auto& idle = it->second;
+
+    // newest first, the oldest ones are the likeliest to have been closed by the server
+    while (!idle.empty()) {
+        auto conn = std::move(idle.back());
+        idle.pop_back();
+
+        if (now - conn->last_used < IDLE_TIMEOUT && conn->socket().is_open()) return conn;
+    }
+
+    return nullptr;
+}
+
+void HttpConnectionPool::release(std::unique_ptr<Connection> conn) {
+    std::lock_guard lock(_mutex);
+
+    auto& idle = _idle[conn->key];
+    if (idle.size() >= MAX_IDLE_PER_HOST) return;
+
+    conn->last_used = std::chrono::steady_clock::now();
+    idle.push_back(std::move(conn));
+
+    if (!_sweeping) {
+        _sweeping = true;
+        net::co_spawn(_exec, sweep_loop(), net::detached);
+    }
+}
+
+void HttpConnectionPool::save_session(const std::string& key, TlsStream& stream) {
+    auto* session = SSL_get1_session(stream.native_handle());
+    if (!session) return;
+
+    if (!SSL_SESSION_is_resumable(session)) {
+        SSL_SESSION_free(session);
+        return;
+    }
+
+    std::lock_guard lock(_mutex);
+
+    auto& slot = _sessions[key];
+    if (slot) SSL_SESSION_free(slot);
+    slot = session;
+}
+
+// closes connections nobody reused in time, and stops once the pool is empty
+boost::asio::awaitable<void> HttpConnectionPool::sweep_loop() {
+    for (;;) {
+        _sweep_timer.expires_after(IDLE_TIMEOUT);
+
+        boost::system::error_code ec;
+        co_await _sweep_timer.async_wait(net::redirect_error(net::use_awaitable, ec));
+        if (ec) co_return;
+
+        std::lock_guard lock(_mutex);
+        auto now = std::chrono::steady_clock::now();
+
+        for (auto it = _idle.begin(); it != _idle.end();) {
+            std::erase_if(it->second, [now](const auto& conn) { return now - conn->last_used >= IDLE_TIMEOUT; });
+            it = it->second.empty() ? _idle.erase(it) : std::next(it);
+        }
+
+        if (_idle.empty()) {
+            _sweeping = false;
+            co_return;
+        }
+    }
+}
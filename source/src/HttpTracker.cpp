@@ -1,8 +1,8 @@
-#include "HttpsTracker.hpp"
+#include "HttpTracker.hpp"
 
 #include <iostream>
 
-boost::urls::url HttpsTracker::build_announce(const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total) {
+boost::urls::url HttpTracker::build_announce(const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total, TrackerEvent event) {
     boost::urls::url announce_url = _url;
 
     announce_url.set_encoded_params({
@@ -16,64 +16,26 @@ boost::urls::url HttpsTracker::build_announce(const std::string& peer_id, uint64
     });
 
     if (_nc.ipv6_outbound && _nc.ipv6_address) announce_url.params().set("ipv6", ipv6_raw);
-    if (downloaded == 0) announce_url.params().set("event", "started");
-    else if (downloaded == total) announce_url.params().set("event", "completed");
+    switch (event) {
+        case TrackerEvent::Started: announce_url.params().set("event", "started"); break;
+        case TrackerEvent::Completed: announce_url.params().set("event", "completed"); break;
+        case TrackerEvent::Stopped: announce_url.params().set("event", "stopped"); break;
+        case TrackerEvent::None: break;
+    }
 
     return announce_url;
 }
 
-boost::asio::awaitable<TrackerResponse> HttpsTracker::async_announce(const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total) {
-    auto executor = co_await net::this_coro::executor;
-    boost::system::error_code ec;
-    
-    _resolver.reset();
-    _stream.reset();
-
-    _resolver.emplace(executor);
-    _stream.emplace(executor, _ssl_ctx);
-
-    if (!SSL_set_tlsext_host_name(_stream->native_handle(), _host.c_str())) {
-        co_return TrackerResponse{ {}, 180, "Tracker unreachable" };
-    }
-
-    auto announce_url = build_announce(peer_id, downloaded, uploaded, total);
+boost::asio::awaitable<TrackerResponse> HttpTracker::async_announce(const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total, TrackerEvent event) {
+    auto announce_url = build_announce(peer_id, downloaded, uploaded, total, event);
     auto target = announce_url.encoded_target();
 
     http::request<http::string_body> req { http::verb::get, target, 11 };
     req.set(http::field::host, _host);
     req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
 
-    // async
-    auto results = co_await _resolver->async_resolve(_host, std::to_string(_port), net::redirect_error(net::use_awaitable, ec));
-    if (ec || stopped) co_return TrackerResponse{ {}, 180, ec.message() };
-
-    co_await net::async_connect(_stream->next_layer(), results, net::redirect_error(net::use_awaitable, ec));
-    if (ec || stopped) co_return TrackerResponse{ {}, 180, ec.message() };
-
-    co_await _stream->async_handshake(ssl::stream_base::client, net::redirect_error(net::use_awaitable, ec));
-    if (ec || stopped) co_return TrackerResponse{ {}, 180, ec.message() };
-
-    co_await http::async_write(*_stream, req, net::redirect_error(net::use_awaitable, ec));
-    if (ec || stopped) co_return TrackerResponse{ {}, 180, ec.message() };
-
-    boost::beast::flat_buffer buffer;
-    http::response<http::dynamic_body> res;
-
-    co_await http::async_read(*_stream, buffer, res, net::redirect_error(net::use_awaitable, ec));
-
-    if (ec || stopped) {
-        // sometimes trackers behave badly, like closing the stream before the response is complete
-        // tolerate it and try to parse what they send
-        if (ec == http::error::end_of_stream || ec == net::ssl::error::stream_truncated) { ec = {}; }
-        else co_return TrackerResponse{ {}, 180, ec.message() };
-    }
-
-    // ignore end of filestream
-    co_await _stream->async_shutdown(net::redirect_error(net::use_awaitable, ec));
-    if (ec || stopped) {
-        if (ec == http::error::end_of_stream || ec == net::ssl::error::stream_truncated) { ec = {}; }
-        else co_return TrackerResponse{ {}, 180, ec.message() };
-    }
+    auto [ec, res] = co_await _pool.request(_scheme == "https", _host, _port, std::move(req), this);
+    if (ec || stopped) co_return TrackerResponse{ {}, 180, stopped ? "Stopped" : ec.message() };
 
     std::string body = boost::beast::buffers_to_string(res.body().data());
 
@@ -84,15 +46,23 @@ boost::asio::awaitable<TrackerResponse> HttpsTracker::async_announce(const std::
     co_return response;
 }
 
-TrackerResponse HttpsTracker::parse_peers(const std::string& body) {
+TrackerResponse HttpTracker::parse_peers(const std::string& body) {
     TrackerResponse out;
 
     try {
-        BEncodeParser resp_parser(body);
+        BEncodeTapeParser resp_parser(body);
         auto root = resp_parser.parse().as_dict();
+
+        // the tracker refused the announce, nothing else in the response means anything
+        if (root.contains("failure reason")) {
+            out.error = std::string(root.at("failure reason").as_string());
+            return out;
+        }
+
         if (root.contains("interval")) out.interval = (uint32_t)root.at("interval").as_int();
+        if (root.contains("min interval")) out.min_interval = (uint32_t)root.at("min interval").as_int();
 
-        const auto& peers_entry = root.at("peers");
+        auto peers_entry = root.at("peers");
         parse_v4(out, peers_entry);
 
         auto peers6 = root.find("peers6");
@@ -105,7 +75,7 @@ TrackerResponse HttpsTracker::parse_peers(const std::string& body) {
     return out;
 }
 
-void HttpsTracker::parse_v4(TrackerResponse& out, const BEncodeValue& peers_entry) {
+void HttpTracker::parse_v4(TrackerResponse& out, const BEncodeView& peers_entry) {
         if (peers_entry.is_list()) {
             for (const auto& p : peers_entry.as_list()) {
                 const auto& d = p.as_dict();
@@ -143,7 +113,7 @@ void HttpsTracker::parse_v4(TrackerResponse& out, const BEncodeValue& peers_entr
         }
 }
 
-void HttpsTracker::parse_v6(TrackerResponse& out, const BEncodeValue& peers_entry) {
+void HttpTracker::parse_v6(TrackerResponse& out, const BEncodeView& peers_entry) {
         if (peers_entry.is_list()) {
             for (const auto& p : peers_entry.as_list()) {
                 const auto& d = p.as_dict();
@@ -181,15 +151,9 @@ void HttpsTracker::parse_v6(TrackerResponse& out, const BEncodeValue& peers_entr
         }
 }
 
-void HttpsTracker::stop() {
+void HttpTracker::stop() {
     stopped = true;
 
-    boost::system::error_code ec;
-
-    if (_resolver) _resolver->cancel();
-
-    if (_stream) {
-        _stream->next_layer().cancel(ec);
-        _stream->next_layer().close(ec);
-    }
-}
\ No newline at end of file
+    // only the connection this tracker is using, the idle ones belong to the pool
+    _pool.cancel(this);
+}
@@ -0,0 +1,74 @@
+#include "MerkleTree.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#include <openssl/sha.h>
+
+Sha256 sha256(std::span<const unsigned char> data) {
+    Sha256 out;
+    SHA256(data.data(), data.size(), out.data());
+    return out;
+}
+
+Sha256 merkle_parent(const Sha256& left, const Sha256& right) {
+    std::array<unsigned char, 64> both;
+    std::memcpy(both.data(), left.data(), 32);
+    std::memcpy(both.data() + 32, right.data(), 32);
+    return sha256(both);
+}
+
+// a 64 GiB file is height 22 above the leaves, 64 covers any tree we could see
+const Sha256& merkle_pad(uint32_t height) {
+    static const auto pads = [] {
+        std::array<Sha256, 64> out{};
+        for (size_t i = 1; i < out.size(); ++i) out[i] = merkle_parent(out[i - 1], out[i - 1]);
+        return out;
+    }();
+
+    return pads[std::min<uint32_t>(height, 63)];
+}
+
+Sha256 merkle_root(std::span<const Sha256> leaves, size_t width, uint32_t pad_height) {
+    std::vector<Sha256> layer(leaves.begin(), leaves.end());
+    layer.resize(std::max<size_t>(width, 1), merkle_pad(pad_height));
+
+    while (layer.size() > 1) {
+        for (size_t i{}; i < layer.size() / 2; ++i) layer[i] = merkle_parent(layer[2 * i], layer[2 * i + 1]);
+        layer.resize(layer.size() / 2);
+        ++pad_height;
+    }
+
+    return layer[0];
+}
+
+std::optional<std::vector<Sha256>> merkle_hashes_with_proof(std::span<const Sha256> layer, uint32_t layer_height, uint32_t index, uint32_t length, uint32_t proof_layers) {
+    auto width = merkle_width(layer.size());
+
+    if (length == 0 || (length & (length - 1)) != 0 || index % length != 0 || uint64_t{index} + length > width) return std::nullopt;
+
+    std::vector<Sha256> current(layer.begin(), layer.end());
+    current.resize(width, merkle_pad(layer_height));
+
+    std::vector<Sha256> out(current.begin() + index, current.begin() + index + length);
+
+    // climb to the root of the requested range
+    auto node = index;
+    for (auto span = length; span > 1; span /= 2) node /= 2;
+
+    auto collapse = [&] {
+        for (size_t i{}; i < current.size() / 2; ++i) current[i] = merkle_parent(current[2 * i], current[2 * i + 1]);
+        current.resize(current.size() / 2);
+    };
+
+    for (auto span = length; span > 1; span /= 2) collapse();
+
+    // then one uncle per layer until the root or the requested depth
+    for (uint32_t i{}; i < proof_layers && current.size() > 1; ++i) {
+        out.push_back(current[node ^ 1]);
+        node /= 2;
+        collapse();
+    }
+
+    return out;
+}
@@ -1,8 +1,136 @@
 #include "MetadataParser.hpp"
 
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // directories are dicts of names, a file is a dict with a single "" key holding its length and pieces root
+    void walk_file_tree(const BEncodeDictView& dir, const std::string& prefix, std::vector<TorrentFileV2>& out) {
+        for (const auto& [name, node]: dir) {
+            if (!node.is_dict()) throw std::runtime_error("Invalid file tree");
+            auto entry = node.as_dict();
+
+            auto leaf = entry.find("");
+            if (leaf != entry.end()) {
+                auto props = leaf->second.as_dict();
+
+                TorrentFileV2 file{ prefix + std::string(name), static_cast<uint64_t>(props.at("length").as_int()), {}, {} };
+
+                auto root = props.find("pieces root");
+                if (root != props.end()) {
+                    auto hash = root->second.as_string();
+                    if (hash.size() != 32) throw std::runtime_error("Invalid pieces root");
+                    file.pieces_root = { reinterpret_cast<const unsigned char*>(hash.data()), 32 };
+                }
+
+                if (file.length > 0 && file.pieces_root.empty()) throw std::runtime_error("File without a pieces root");
+
+                out.push_back(std::move(file));
+                continue;
+            }
+
+            walk_file_tree(entry, prefix + std::string(name) + "/", out);
+        }
+    }
+
+    class OwnedSource: public MetadataSource {
+    public:
+        explicit OwnedSource(std::vector<char> data): _data(std::move(data)) {}
+        std::string_view bytes() const override { return { _data.data(), _data.size() }; }
+
+    private:
+        std::vector<char> _data;
+    };
+
+    class BorrowedSource: public MetadataSource {
+    public:
+        explicit BorrowedSource(std::string_view data): _data(data) {}
+        std::string_view bytes() const override { return _data; }
+
+    private:
+        std::string_view _data;
+    };
+
+    class MappedSource: public MetadataSource {
+    public:
+        explicit MappedSource(const std::filesystem::path& path) {
+#ifdef _WIN32
+            HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE) throw std::runtime_error("Could not open " + path.string());
+
+            LARGE_INTEGER size{};
+            GetFileSizeEx(file, &size);
+            _size = static_cast<size_t>(size.QuadPart);
+
+            HANDLE mapping = _size ? CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+            CloseHandle(file);
+            if (!mapping) throw std::runtime_error("Could not map " + path.string());
+
+            _base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+            if (!_base) throw std::runtime_error("Could not map " + path.string());
+#else
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) throw std::runtime_error("Could not open " + path.string());
+
+            struct stat st{};
+            ::fstat(fd, &st);
+            _size = static_cast<size_t>(st.st_size);
+
+            void* base = _size ? ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+            ::close(fd);
+            if (base == MAP_FAILED) throw std::runtime_error("Could not map " + path.string());
+
+            _base = base;
+#endif
+        }
+
+        ~MappedSource() override {
+#ifdef _WIN32
+            UnmapViewOfFile(_base);
+#else
+            ::munmap(_base, _size);
+#endif
+        }
+
+        MappedSource(const MappedSource&) = delete;
+        MappedSource& operator=(const MappedSource&) = delete;
+
+        std::string_view bytes() const override { return { static_cast<const char*>(_base), _size }; }
+
+    private:
+        void* _base = nullptr;
+        size_t _size{};
+    };
+}
+
+Metadata::Metadata(std::unique_ptr<MetadataSource> source): _source(std::move(source)) {
+    parse_torrent();
+    compute_info_hash_hex();
+}
+
+Metadata::Metadata(std::vector<char> data): Metadata(std::make_unique<OwnedSource>(std::move(data))) {}
+
+Metadata Metadata::map_file(const std::filesystem::path& path) {
+    return Metadata(std::make_unique<MappedSource>(path));
+}
+
+Metadata Metadata::borrow(std::string_view data) {
+    return Metadata(std::make_unique<BorrowedSource>(data));
+}
+
 void Metadata::parse_torrent() {
 
-	BEncodeParser parser(in);
+	BEncodeTapeParser parser(_source->bytes());
 
 	auto dict = parser.parse().as_dict();
 
@@ -46,29 +174,30 @@ void Metadata::parse_torrent() {
     // Pieces (concatenated SHA1 hashes)
     auto pieces_it = info.find("pieces");
     if (pieces_it != info.end() && pieces_it->second.is_string()) {
-        const auto& pieces_str = pieces_it->second.as_string();
-        size_t n = pieces_str.size() / 20;
-        piece_hashes.resize(n);
-        for (size_t i = 0; i < n; ++i) {
-            std::memcpy(piece_hashes[i].data(), pieces_str.data() + i * 20, 20);
-        }
+        auto pieces_str = pieces_it->second.as_string();
+        piece_hashes = { reinterpret_cast<const unsigned char*>(pieces_str.data()), pieces_str.size() / 20 * 20 };
     }
 
     // Files
     auto files_it = info.find("files");
     if (files_it != info.end() && files_it->second.is_list()) {
         // Multi-file torrent
+        files.reserve(files_it->second.as_list().size());
 
         for (const auto& fval : files_it->second.as_list()) {
             if (!fval.is_dict()) continue;
             const auto& fdict = fval.as_dict();
             TorrentFile file;
 
+            // BEP 47 padding, a hybrid pads every file out to a piece boundary so both versions agree on pieces
+            auto attr_it = fdict.find("attr");
+            file.pad = attr_it != fdict.end() && attr_it->second.is_string() && attr_it->second.as_string().contains('p');
+
             // Path (list of strings)
             auto path_it = fdict.find("path");
             if (path_it != fdict.end() && path_it->second.is_list()) {
                 auto full_path = path_it->second.as_list()
-                    | std::views::transform([](const BEncodeValue& b) { return b.as_string(); })
+                    | std::views::transform([](const BEncodeView& b) { return b.as_string(); })
                     | std::views::join_with('/')
 					| std::ranges::to<std::string>();
 
@@ -104,13 +233,92 @@ void Metadata::parse_torrent() {
     auto creation_date_it = dict.find("creation date");
     if (creation_date_it != dict.end() && creation_date_it->second.is_int()) creation_date = static_cast<uint64_t>(creation_date_it->second.as_int());
 
-    // Info hash (SHA1 of bencoded info dictionary)
+    // Info hash (SHA1 of bencoded info dictionary), hashed in place from the input
+    auto info_bencoded = it->second.raw();
+    auto info_bytes = std::span(reinterpret_cast<const unsigned char*>(info_bencoded.data()), info_bencoded.size());
+
+    auto meta_version = info.find("meta version");
+    bool v2 = meta_version != info.end() && meta_version->second.is_int() && meta_version->second.as_int() == 2;
+
+    if (!v2) {
+        SHA1(info_bytes.data(), info_bytes.size(), info_hash.data());
+        return;
+    }
+
+    SHA256(info_bytes.data(), info_bytes.size(), info_hash_v2.data());
+    parse_v2(dict, info);
+
+    if (version == TorrentVersion::Hybrid) SHA1(info_bytes.data(), info_bytes.size(), info_hash.data());
+    else std::memcpy(info_hash.data(), info_hash_v2.data(), info_hash.size());
+}
+
+// BEP 52, pieces never span files, so every piece is one subtree of its file's hash tree
+void Metadata::parse_v2(const BEncodeDictView& root, const BEncodeDictView& info) {
+    auto tree = info.find("file tree");
+    if (tree == info.end() || !tree->second.is_dict()) throw std::runtime_error("Missing file tree");
+
+    if (piece_length < MERKLE_BLOCK_SIZE || (piece_length & (piece_length - 1)) != 0) throw std::runtime_error("Invalid v2 piece length");
+
+    walk_file_tree(tree->second.as_dict(), "", v2_files);
+
+    std::optional<BEncodeDictView> layers;
+    auto layers_it = root.find("piece layers");
+    if (layers_it != root.end() && layers_it->second.is_dict()) layers = layers_it->second.as_dict();
+
+    version = piece_hashes.empty() ? TorrentVersion::V2 : TorrentVersion::Hybrid;
 
-	const auto& [start, end] = parser.get_info_start_end();
+    const auto blocks_per_piece = static_cast<uint32_t>(piece_length / MERKLE_BLOCK_SIZE);
 
-	std::string info_bencoded = in.substr(start, end - start);
+    for (auto& file: v2_files) {
+        if (file.length == 0) continue;
 
-    SHA1(reinterpret_cast<const unsigned char*>(info_bencoded.data()), info_bencoded.size(), info_hash.data());
+        auto blocks = (file.length + MERKLE_BLOCK_SIZE - 1) / MERKLE_BLOCK_SIZE;
+
+        if (file.length <= piece_length) {
+            piece_roots.push_back({ file.pieces_root, file.pieces_root, 0, merkle_width(blocks), static_cast<uint32_t>(file.length) });
+            continue;
+        }
+
+        auto pieces = (file.length + piece_length - 1) / piece_length;
+
+        if (layers) {
+            auto layer = layers->find(std::string_view(reinterpret_cast<const char*>(file.pieces_root.data()), 32));
+            if (layer != layers->end() && layer->second.is_string() && layer->second.as_string().size() == pieces * 32) {
+                auto bytes = layer->second.as_string();
+                file.piece_layer = { reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size() };
+            }
+        }
+
+        // without its layer a file can only be checked against the v1 hashes
+        if (file.piece_layer.empty() && version == TorrentVersion::V2) throw std::runtime_error("Missing piece layer for " + file.path);
+
+        for (uint64_t k{}; k < pieces; ++k) {
+            auto hash = file.piece_layer.empty() ? std::span<const unsigned char>{} : file.piece_layer.subspan(k * 32, 32);
+            auto length = std::min<uint64_t>(piece_length, file.length - k * piece_length);
+            piece_roots.push_back({ hash, file.pieces_root, static_cast<uint32_t>(k * blocks_per_piece), blocks_per_piece, static_cast<uint32_t>(length) });
+        }
+    }
+
+    if (version == TorrentVersion::Hybrid) {
+        if (piece_roots.size() != piece_hashes.size() / 20) throw std::runtime_error("v1 and v2 pieces of a hybrid torrent disagree");
+        return;
+    }
+
+    // a pure v2 torrent has no v1 file list, lay the files out with the padding the piece alignment implies
+    files.clear();
+    total_size = 0;
+
+    for (size_t i{}; i < v2_files.size(); ++i) {
+        const auto& file = v2_files[i];
+        files.push_back({ file.path, file.length });
+        total_size += file.length;
+
+        auto tail = file.length % piece_length;
+        if (tail == 0 || i + 1 == v2_files.size()) continue;
+
+        files.push_back({ ".pad/" + std::to_string(piece_length - tail), piece_length - tail, true });
+        total_size += piece_length - tail;
+    }
 }
 
 void Metadata::compute_info_hash_hex() {
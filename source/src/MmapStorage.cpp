@@ -0,0 +1,226 @@
+#include "MmapStorage.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <print>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    uint64_t page_size() {
+#ifdef _WIN32
+        static const uint64_t size = [] {
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            return static_cast<uint64_t>(info.dwPageSize);
+        }();
+#else
+        static const uint64_t size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+#endif
+        return size;
+    }
+}
+
+// a mapping covers the whole file, so a file that grows as it is written is not an option here
+MmapStorage::MmapStorage(std::vector<StorageFile> files, AllocationMode allocation):
+    BaseStorage(std::move(files), allocation == AllocationMode::None ? AllocationMode::Sparse : allocation) {
+    _mappings.resize(_files.size());
+}
+
+MmapStorage::~MmapStorage() {
+    std::lock_guard lock(_mutex);
+
+    flush_dirty(true);
+    for (auto& m: _mappings) unmap(m);
+    for (auto& m: _retired) unmap(m);
+}
+
+// map lazily, a torrent with thousands of files should not map all of them up front
+// files are only created by a write, a read of a file that doesn't exist yet just fails
+// reads map read-only so seeding from read-only files works, the first write maps the file again writable
+bool MmapStorage::ensure_mapped(size_t file_index, bool write) {
+    auto& m = _mappings[file_index];
+    if (m.base && (m.writable || !write)) return true;
+    if (m.failed) return false;
+
+    const auto& file = _files[file_index];
+
+    // nothing to map, and mmap() rejects zero length anyway
+    if (file.length == 0) { m.failed = true; return false; }
+
+    if (write) create_parent_directories(file_index);
+
+    uint64_t length = file.length;
+
+#ifdef _WIN32
+    HANDLE handle = CreateFileW(file.path.c_str(), write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, write ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) { m.failed = write; return false; }
+
+    if (write) allocate(file_index, handle);
+    else {
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) { CloseHandle(handle); return false; }
+        length = std::min<uint64_t>(length, size.QuadPart);
+    }
+
+    HANDLE mapping = CreateFileMappingW(handle, nullptr, write ? PAGE_READWRITE : PAGE_READONLY, static_cast<DWORD>(length >> 32), static_cast<DWORD>(length & 0xFFFFFFFF), nullptr);
+    if (!mapping) { CloseHandle(handle); m.failed = write; return false; }
+
+    void* view = MapViewOfFile(mapping, write ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, 0);
+    if (!view) { CloseHandle(mapping); CloseHandle(handle); m.failed = write; return false; }
+#else
+    int fd = ::open(file.path.c_str(), (write ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC, 0644);
+    if (fd < 0) { m.failed = write; return false; }
+
+    // a writable view covers the whole file, it has to be at least that long, touching a page past the end is a SIGBUS
+    // a read-only one stops at the end of what is there
+    if (write) allocate(file_index, fd);
+    else {
+        struct stat st{};
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) { ::close(fd); return false; }
+        length = std::min<uint64_t>(length, st.st_size);
+    }
+
+    void* view = ::mmap(nullptr, length, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+
+    if (view == MAP_FAILED) { m.failed = write; return false; }
+#endif
+
+    if (m.base) {
+        _retired.push_back(m);
+        m = Mapping{};
+    }
+
+#ifdef _WIN32
+    m.file = handle;
+    m.mapping = mapping;
+#endif
+    m.base = static_cast<unsigned char*>(view);
+    m.length = length;
+    m.writable = write;
+
+    advise(m);
+    return true;
+}
+
+void MmapStorage::advise(Mapping& m) {
+#ifndef _WIN32
+    ::madvise(m.base, m.length, _pattern == AccessPattern::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+#endif
+    // windows only takes access hints at CreateFile time, and those apply to the cache manager, not to views
+}
+
+void MmapStorage::set_access_pattern(AccessPattern pattern) {
+    std::lock_guard lock(_mutex);
+    if (pattern == _pattern) return;
+    _pattern = pattern;
+
+    for (auto& m: _mappings) {
+        if (m.base) advise(m);
+    }
+}
+
+// a mapping that can't be backed (ENOSPC on a sparse file) only shows up as SIGBUS on the copy, full allocation avoids that
+boost::asio::awaitable<bool> MmapStorage::write_at(size_t file_index, uint64_t file_offset, std::span<const unsigned char> data) {
+    unsigned char* base;
+    {
+        std::lock_guard lock(_mutex);
+        if (!ensure_mapped(file_index, true)) {
+            std::println("Write to {} failed", _files[file_index].path.string());
+            co_return false;
+        }
+        base = _mappings[file_index].base;
+    }
+
+    std::memcpy(base + file_offset, data.data(), data.size());
+
+    std::lock_guard lock(_mutex);
+    auto& m = _mappings[file_index];
+
+    m.dirty_begin = std::min(m.dirty_begin, file_offset);
+    m.dirty_end = std::max(m.dirty_end, file_offset + data.size());
+
+    _dirty_bytes += data.size();
+    if (_dirty_bytes >= FLUSH_BATCH_BYTES) flush_dirty(false);
+
+    co_return true;
+}
+
+boost::asio::awaitable<bool> MmapStorage::read_at(size_t file_index, uint64_t file_offset, std::span<unsigned char> out) {
+    unsigned char* base;
+    AccessPattern pattern;
+    {
+        std::lock_guard lock(_mutex);
+        if (!ensure_mapped(file_index, false)) co_return false;
+
+        // a read-only view ends where the file did when it was mapped
+        if (file_offset + out.size() > _mappings[file_index].length) co_return false;
+
+        base = _mappings[file_index].base;
+        pattern = _pattern;
+    }
+
+#ifndef _WIN32
+    // random access mapping has readahead disabled, fault the block in with one request instead of page by page
+    if (pattern == AccessPattern::Random) {
+        auto aligned = file_offset & ~(page_size() - 1);
+        ::madvise(base + aligned, file_offset + out.size() - aligned, MADV_WILLNEED);
+    }
+#endif
+
+    std::memcpy(out.data(), base + file_offset, out.size());
+    co_return true;
+}
+
+void MmapStorage::sync() {
+    std::lock_guard lock(_mutex);
+    flush_dirty(true);
+}
+
+// kick off writeback for every dirty range, only block on it if asked to
+void MmapStorage::flush_dirty(bool wait) {
+    const auto page = page_size();
+
+    for (auto& m: _mappings) {
+        if (!m.base || m.dirty_end == 0) continue;
+
+        auto begin = m.dirty_begin & ~(page - 1);
+        auto length = m.dirty_end - begin;
+
+#ifdef _WIN32
+        FlushViewOfFile(m.base + begin, static_cast<SIZE_T>(length));
+        if (wait) FlushFileBuffers(static_cast<HANDLE>(m.file));
+#else
+        ::msync(m.base + begin, length, wait ? MS_SYNC : MS_ASYNC);
+#endif
+
+        m.dirty_begin = UINT64_MAX;
+        m.dirty_end = 0;
+    }
+
+    _dirty_bytes = 0;
+}
+
+void MmapStorage::unmap(Mapping& m) {
+    if (!m.base) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(m.base);
+    CloseHandle(static_cast<HANDLE>(m.mapping));
+    CloseHandle(static_cast<HANDLE>(m.file));
+#else
+    ::munmap(m.base, m.length);
+#endif
+
+    m.base = nullptr;
+}
@@ -0,0 +1,317 @@
+#include "NativeFile.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <climits>
+#include <cerrno>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+
+const native_handle_t invalid_native_handle = INVALID_HANDLE_VALUE;
+
+namespace {
+    // one event per disk thread, ops on an overlapped handle run in parallel instead of serializing on the file object
+    HANDLE thread_event() {
+        thread_local HANDLE event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        return event;
+    }
+
+    // ReadFile/WriteFile take a DWORD length
+    constexpr uint64_t MAX_CHUNK = 1ull << 30;
+}
+
+native_handle_t open_native(const std::filesystem::path& path, bool write, bool direct) {
+    DWORD access = write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
+    DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | (direct ? FILE_FLAG_NO_BUFFERING : 0);
+    return CreateFileW(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, write ? OPEN_ALWAYS : OPEN_EXISTING, flags, nullptr);
+}
+
+void close_native(native_handle_t handle) {
+    if (handle != INVALID_HANDLE_VALUE) CloseHandle(handle);
+}
+
+bool set_file_size(native_handle_t handle, uint64_t length) {
+    // without the sparse flag ntfs zero fills everything before the first write past the valid data length
+    OVERLAPPED ov{};
+    ov.hEvent = thread_event();
+
+    DWORD done{};
+    if (!DeviceIoControl(handle, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, nullptr, &ov)) {
+        if (GetLastError() == ERROR_IO_PENDING) GetOverlappedResult(handle, &ov, &done, TRUE);
+    }
+
+    FILE_END_OF_FILE_INFO eof{};
+    eof.EndOfFile.QuadPart = static_cast<LONGLONG>(length);
+    return SetFileInformationByHandle(handle, FileEndOfFileInfo, &eof, sizeof(eof)) != 0;
+}
+
+bool preallocate_native(native_handle_t handle, uint64_t length) {
+    FILE_ALLOCATION_INFO alloc{};
+    alloc.AllocationSize.QuadPart = static_cast<LONGLONG>(length);
+    if (!SetFileInformationByHandle(handle, FileAllocationInfo, &alloc, sizeof(alloc))) return false;
+
+    FILE_END_OF_FILE_INFO eof{};
+    eof.EndOfFile.QuadPart = static_cast<LONGLONG>(length);
+    return SetFileInformationByHandle(handle, FileEndOfFileInfo, &eof, sizeof(eof)) != 0;
+}
+
+bool sync_native(native_handle_t handle) {
+    return FlushFileBuffers(handle) != 0;
+}
+
+bool write_file_atomic(const std::filesystem::path& path, std::span<const unsigned char> data) {
+    auto tmp = path;
+    tmp += ".tmp";
+
+    HANDLE handle = CreateFileW(tmp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+
+    DWORD done{};
+    bool ok = WriteFile(handle, data.data(), static_cast<DWORD>(data.size()), &done, nullptr) && done == data.size();
+    ok = ok && FlushFileBuffers(handle);
+    CloseHandle(handle);
+
+    if (!ok) return false;
+    return MoveFileExW(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+bool positional_write(native_handle_t handle, uint64_t offset, std::span<const unsigned char> data) {
+    while (!data.empty()) {
+        OVERLAPPED ov{};
+        ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        ov.hEvent = thread_event();
+
+        DWORD done{};
+        auto chunk = static_cast<DWORD>(std::min<uint64_t>(data.size(), MAX_CHUNK));
+
+        if (!WriteFile(handle, data.data(), chunk, nullptr, &ov) && GetLastError() != ERROR_IO_PENDING) return false;
+        if (!GetOverlappedResult(handle, &ov, &done, TRUE) || done == 0) return false;
+
+        data = data.subspan(done);
+        offset += done;
+    }
+    return true;
+}
+
+// WriteFileGather only takes page sized, unbuffered writes, so write each buffer on its own
+bool positional_writev(native_handle_t handle, uint64_t offset, std::span<const std::span<const unsigned char>> buffers) {
+    for (auto buffer: buffers) {
+        if (!positional_write(handle, offset, buffer)) return false;
+        offset += buffer.size();
+    }
+    return true;
+}
+
+bool positional_read(native_handle_t handle, uint64_t offset, std::span<unsigned char> out) {
+    while (!out.empty()) {
+        OVERLAPPED ov{};
+        ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        ov.hEvent = thread_event();
+
+        DWORD done{};
+        auto chunk = static_cast<DWORD>(std::min<uint64_t>(out.size(), MAX_CHUNK));
+
+        if (!ReadFile(handle, out.data(), chunk, nullptr, &ov) && GetLastError() != ERROR_IO_PENDING) return false;
+
+        // past the end of file
+        if (!GetOverlappedResult(handle, &ov, &done, TRUE) || done == 0) return false;
+
+        out = out.subspan(done);
+        offset += done;
+    }
+    return true;
+}
+
+// a short read only happens at end of file, and with direct I/O the next offset wouldn't be aligned anyway
+int64_t positional_read_some(native_handle_t handle, uint64_t offset, std::span<unsigned char> out) {
+    int64_t total{};
+
+    while (!out.empty()) {
+        OVERLAPPED ov{};
+        ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        ov.hEvent = thread_event();
+
+        DWORD done{};
+        auto chunk = static_cast<DWORD>(std::min<uint64_t>(out.size(), MAX_CHUNK));
+
+        if (!ReadFile(handle, out.data(), chunk, nullptr, &ov)) {
+            auto err = GetLastError();
+            if (err == ERROR_HANDLE_EOF) break;
+            if (err != ERROR_IO_PENDING) return -1;
+        }
+
+        if (!GetOverlappedResult(handle, &ov, &done, TRUE)) {
+            if (GetLastError() == ERROR_HANDLE_EOF) break;
+            return -1;
+        }
+
+        total += done;
+        if (done < chunk) break;
+
+        out = out.subspan(done);
+        offset += done;
+    }
+    return total;
+}
+
+#else
+
+const native_handle_t invalid_native_handle = -1;
+
+native_handle_t open_native(const std::filesystem::path& path, bool write, bool direct) {
+    int flags = (write ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC;
+#ifdef O_DIRECT
+    if (direct) flags |= O_DIRECT;
+#endif
+
+    int fd = ::open(path.c_str(), flags, 0644);
+
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+    // macos has no O_DIRECT, turning off caching on the descriptor is the closest thing
+    if (fd >= 0 && direct) ::fcntl(fd, F_NOCACHE, 1);
+#endif
+
+    return fd;
+}
+
+void close_native(native_handle_t handle) {
+    if (handle >= 0) ::close(handle);
+}
+
+bool set_file_size(native_handle_t handle, uint64_t length) {
+    while (::ftruncate(handle, static_cast<off_t>(length)) != 0) {
+        if (errno != EINTR) return false;
+    }
+    return true;
+}
+
+bool preallocate_native(native_handle_t handle, uint64_t length) {
+#ifdef __linux__
+    // posix_fallocate returns the error instead of setting errno
+    int err = ::posix_fallocate(handle, 0, static_cast<off_t>(length));
+    if (err != 0 && err != EOPNOTSUPP && err != EINVAL) return false;
+#endif
+
+    // also trims a file that used to be longer, and is all we get where fallocate is missing
+    return set_file_size(handle, length);
+}
+
+bool sync_native(native_handle_t handle) {
+    return ::fdatasync(handle) == 0;
+}
+
+bool write_file_atomic(const std::filesystem::path& path, std::span<const unsigned char> data) {
+    auto tmp = path;
+    tmp += ".tmp";
+
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+
+    bool ok = positional_write(fd, 0, data) && ::fsync(fd) == 0;
+    ::close(fd);
+
+    if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0) return false;
+
+    // make the rename itself durable
+    auto parent = path.parent_path();
+    int dir = ::open(parent.empty() ? "." : parent.c_str(), O_RDONLY | O_CLOEXEC);
+    if (dir >= 0) {
+        ::fsync(dir);
+        ::close(dir);
+    }
+    return true;
+}
+
+bool positional_write(native_handle_t handle, uint64_t offset, std::span<const unsigned char> data) {
+    while (!data.empty()) {
+        auto n = ::pwrite(handle, data.data(), data.size(), static_cast<off_t>(offset));
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+
+        data = data.subspan(static_cast<size_t>(n));
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+bool positional_writev(native_handle_t handle, uint64_t offset, std::span<const std::span<const unsigned char>> buffers) {
+    std::vector<iovec> iov;
+    iov.reserve(buffers.size());
+
+    for (auto buffer: buffers) {
+        if (!buffer.empty()) iov.push_back({ const_cast<unsigned char*>(buffer.data()), buffer.size() });
+    }
+
+    size_t first = 0;
+
+    while (first < iov.size()) {
+        auto count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+        auto n = ::pwritev(handle, iov.data() + first, count, static_cast<off_t>(offset));
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+
+        offset += static_cast<uint64_t>(n);
+
+        // skip what was written, a short write can end in the middle of a buffer
+        auto written = static_cast<size_t>(n);
+        while (first < iov.size() && written >= iov[first].iov_len) written -= iov[first++].iov_len;
+
+        if (written > 0) {
+            iov[first].iov_base = static_cast<unsigned char*>(iov[first].iov_base) + written;
+            iov[first].iov_len -= written;
+        }
+    }
+    return true;
+}
+
+bool positional_read(native_handle_t handle, uint64_t offset, std::span<unsigned char> out) {
+    while (!out.empty()) {
+        auto n = ::pread(handle, out.data(), out.size(), static_cast<off_t>(offset));
+
+        if (n < 0 && errno == EINTR) continue;
+
+        // past the end of file
+        if (n <= 0) return false;
+
+        out = out.subspan(static_cast<size_t>(n));
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+// a short read only happens at end of file, and with direct I/O the next offset wouldn't be aligned anyway
+int64_t positional_read_some(native_handle_t handle, uint64_t offset, std::span<unsigned char> out) {
+    int64_t total{};
+
+    while (!out.empty()) {
+        auto n = ::pread(handle, out.data(), out.size(), static_cast<off_t>(offset));
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+
+        total += n;
+        if (static_cast<size_t>(n) < out.size()) break;
+
+        out = out.subspan(static_cast<size_t>(n));
+        offset += static_cast<uint64_t>(n);
+    }
+    return total;
+}
+
+#endif
@@ -60,6 +60,9 @@ void PeerConnection::build_handshake() {
 
     std::memcpy(&_handshake_buf[1], "BitTorrent protocol", 19);
     std::memset(&_handshake_buf[20], 0, 8);
+
+    // BEP 52, we speak the v2 hash messages
+    if (_pm.has_v2()) _handshake_buf[27] |= 0x10;
     std::memcpy(&_handshake_buf[28], _info_hash.data(), 20);
     std::memcpy(&_handshake_buf[48], _peer_id.data(), 20);
 }
@@ -111,6 +114,7 @@ bool PeerConnection::validate_handshake() {
         const unsigned char* peer_id = _handshake_buf.data() + 48;
 
         p.id() = decode_peer_id(std::string_view(reinterpret_cast<const char*>(peer_id), 20));
+        _peer_v2 = _pm.has_v2() && (_handshake_buf[27] & 0x10);
         return true;
     }
     return false;
@@ -192,6 +196,17 @@ void PeerConnection::handle_have() {
 }
 
 boost::asio::awaitable<void> PeerConnection::maybe_request_next() {
+    while (_peer_v2 && _hash_requests.size() < MAX_HASH_REQUESTS) {
+        auto req = _pm.next_hash_request(_peer_bitfield);
+        if (!req) break;
+
+        PendingHashRequest pending{ {}, req->index, req->length };
+        std::copy_n(req->root.begin(), 32, pending.root.begin());
+        _hash_requests.push_back(pending);
+
+        co_await send_hash_message(Message_ID::HashRequest, *req);
+    }
+
     while (!am_choked && _in_flight < MAX_IN_FLIGHT) {
         auto req = _pm.next_block_request(_peer_bitfield);
         if (!req) break;
@@ -226,7 +241,72 @@ void PeerConnection::handle_piece() {
     }
 
     auto block = std::span<const unsigned char>(msg_buf).subspan(8);
-    _pm.add_block(piece, begin, block);
+    _pm.add_block(piece, begin, block, p.addr());
+
+    // v2 torrents can tell which peer sent a bad block, one that keeps doing it is dropped
+    if (_pm.hash_failures(p.addr()) >= MAX_HASH_FAILURES) request_stop();
+}
+
+// <pieces root 32><base layer><index><length><proof layers>, the same for requests, hashes and rejects
+std::optional<HashRequest> PeerConnection::parse_hash_header() const {
+    if (msg_buf.size() < 48) return std::nullopt;
+
+    HashRequest out{ std::span<const unsigned char>(msg_buf).first(32), 0, 0, 0, 0 };
+
+    uint32_t fields[4];
+    std::memcpy(fields, msg_buf.data() + 32, sizeof(fields));
+    for (auto& f: fields) boost::endian::big_to_native_inplace(f);
+
+    out.base_layer = fields[0];
+    out.index = fields[1];
+    out.length = fields[2];
+    out.proof_layers = fields[3];
+
+    return out;
+}
+
+boost::asio::awaitable<void> PeerConnection::send_hash_message(Message_ID id, const HashRequest& header, std::span<const Sha256> hashes) {
+    std::vector<unsigned char> buf(5 + 48 + hashes.size() * 32);
+
+    uint32_t len = boost::endian::native_to_big<uint32_t>(static_cast<uint32_t>(buf.size() - 4));
+    std::memcpy(buf.data(), &len, 4);
+    buf[4] = static_cast<unsigned char>(id);
+
+    std::memcpy(buf.data() + 5, header.root.data(), 32);
+
+    uint32_t fields[4] = { header.base_layer, header.index, header.length, header.proof_layers };
+    for (auto& f: fields) boost::endian::native_to_big_inplace(f);
+    std::memcpy(buf.data() + 37, fields, sizeof(fields));
+
+    for (size_t i{}; i < hashes.size(); ++i) std::memcpy(buf.data() + 53 + i * 32, hashes[i].data(), 32);
+
+    boost::system::error_code ec;
+    co_await boost::asio::async_write(_socket, boost::asio::buffer(buf), boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+}
+
+boost::asio::awaitable<void> PeerConnection::handle_hash_request() {
+    auto header = parse_hash_header();
+    if (!header || peer_choked) co_return;
+
+    auto hashes = _pm.serve_hashes(*header);
+
+    if (hashes) co_await send_hash_message(Message_ID::Hashes, *header, *hashes);
+    else co_await send_hash_message(Message_ID::HashReject, *header);
+}
+
+// answers to our own requests
+void PeerConnection::handle_hashes(Message_ID id) {
+    auto header = parse_hash_header();
+    if (!header) return;
+
+    auto pending = std::ranges::find_if(_hash_requests, [&](const PendingHashRequest& r) {
+        return std::ranges::equal(r.root, header->root) && r.index == header->index && r.length == header->length;
+    });
+    if (pending == _hash_requests.end()) return;
+    _hash_requests.erase(pending);
+
+    if (id == Message_ID::Hashes) _pm.add_hashes(*header, std::span<const unsigned char>(msg_buf).subspan(48));
+    else _pm.return_hash_request(*header);
 }
 
 // indicate interest to the peer
@@ -407,6 +487,16 @@ boost::asio::awaitable<void> PeerConnection::message_loop() {
                     }
                     break;
 
+                case Message_ID::HashRequest:
+                    co_await handle_hash_request();
+                    break;
+
+                case Message_ID::Hashes:
+                case Message_ID::HashReject:
+                    handle_hashes(id);
+                    co_await maybe_request_next();
+                    break;
+
                 case Message_ID::Bitfield:
                     handle_bitfield();
                     if (!am_interested) {
@@ -434,6 +524,9 @@ boost::asio::awaitable<void> PeerConnection::message_loop() {
     in_flight_blocks.clear();
     _in_flight = 0;
 
+    for (auto& pending: _hash_requests) _pm.return_hash_request({ pending.root, 0, pending.index, pending.length, 0 });
+    _hash_requests.clear();
+
     co_return;
 }
 
@@ -8,40 +8,111 @@
 
 #include <openssl/sha.h>
 
-PieceManager::PieceManager(boost::asio::any_io_executor disk_exec, size_t num_pieces, size_t piece_length, size_t total_size, const std::vector<std::array<unsigned char, 20>>& piece_hashes, FileManager& fm, std::function<void(uint32_t)> callback): 
+PieceManager::PieceManager(boost::asio::any_io_executor net_exec, boost::asio::any_io_executor disk_exec, size_t num_pieces, size_t piece_length, size_t total_size, std::span<const unsigned char> piece_hashes, std::span<const PieceRoot> piece_roots, FileManager& fm, std::function<void(uint32_t)> callback): 
+        _net_exec(net_exec),
         _disk_exec(disk_exec),
+        _disk_idle(net_exec, boost::asio::steady_timer::time_point::max()),
         _num_pieces(num_pieces),
         _piece_length(piece_length),
         _total_size(total_size),
         _piece_hashes(piece_hashes),
+        _piece_roots(piece_roots),
         _fm(fm),
         _piece_complete_callback(std::move(callback))
     {
         _my_bitfield.resize((_num_pieces + 7) / 8);
         _pieces.resize(_num_pieces);
 
-        auto completed = _fm.read_save_file();
-        for (auto piece: completed) {
-            downloaded += piece_length_for_index(piece);
-            ++_completed_pieces;
-            _pieces[piece].is_complete = true;
-            set_my_bitfield(piece);
+        if (has_v2()) {
+            _hash_state.resize(_num_pieces, HashState::None);
+
+            for (uint32_t i{}; i < _piece_roots.size(); ++i) {
+                const auto& root = _piece_roots[i].file_root;
+                if (_piece_roots[i].first_block == 0) _first_piece.emplace(std::string_view(reinterpret_cast<const char*>(root.data()), root.size()), i);
+            }
         }
+
+        // completed pieces are filled in by load_resume()
+    }
+
+// the resume file is read and every file stat'ed on the disk executor, a torrent with thousands of files would stall the network thread
+boost::asio::awaitable<void> PieceManager::load_resume() {
+    auto resume = co_await boost::asio::co_spawn(_disk_exec, [this]() -> boost::asio::awaitable<ResumeState> { co_return _fm.load_resume(); }, boost::asio::use_awaitable);
+
+    for (auto piece: resume.completed) {
+        downloaded += piece_length_for_index(piece);
+        ++_completed_pieces;
+        _pieces[piece].is_complete = true;
+        set_my_bitfield(piece);
     }
 
+    // block data is read back later, see restore_partial_pieces()
+    _partial_to_restore = std::move(resume.partial);
+    _pieces_to_recheck = std::move(resume.recheck);
+
+    update_access_pattern();
+}
+
 boost::asio::awaitable<std::optional<std::vector<unsigned char>>> PieceManager::async_fetch_block(uint32_t piece, uint32_t begin, uint32_t length) {
+    if (_stopping) co_return std::nullopt;
 
     // launch reads from disk executor
-    auto data = co_await boost::asio::co_spawn(
-        _disk_exec,
-        _fm.read_block(piece, begin, length),
-        boost::asio::use_awaitable
-    );
+    std::optional<std::vector<unsigned char>> data;
+    ++_disk_reads;
+    try {
+        data = co_await boost::asio::co_spawn(
+            _disk_exec,
+            _fm.read_block(piece, begin, length),
+            boost::asio::use_awaitable
+        );
+    }
+    catch (const std::exception& e) {
+        std::println("Read of piece {} failed: {}", piece, e.what());
+    }
+
+    if (--_disk_reads == 0 && _disk_queue_jobs == 0) _disk_idle.cancel();
 
     if (data) { uploaded += data->size(); co_return data; }
     co_return std::nullopt;
 }
 
+// runs on the network executor, so the queue accounting needs no locking
+boost::asio::awaitable<void> PieceManager::write_to_disk(uint32_t piece, std::vector<unsigned char> data) {
+    uint64_t size = data.size();
+
+    _disk_queue_bytes += size;
+    ++_disk_queue_jobs;
+    if (_disk_queue_bytes >= DISK_QUEUE_HIGH_WATERMARK) _disk_throttled = true;
+
+    try {
+        co_await boost::asio::co_spawn(
+            _disk_exec,
+            _fm.write_piece(piece, std::move(data)),
+            boost::asio::use_awaitable
+        );
+    }
+    catch (const std::exception& e) {
+        std::println("Write of piece {} failed: {}", piece, e.what());
+    }
+
+    _disk_queue_bytes -= size;
+    --_disk_queue_jobs;
+    if (_disk_queue_bytes <= DISK_QUEUE_LOW_WATERMARK) _disk_throttled = false;
+    if (_disk_queue_jobs == 0 && _disk_reads == 0) _disk_idle.cancel();
+}
+
+boost::asio::awaitable<void> PieceManager::drain_disk() {
+    // a piece finished after this would reach the file manager after its last flush
+    request_stop();
+
+    while (_disk_queue_jobs > 0 || _disk_reads > 0) {
+        _disk_idle.expires_at(boost::asio::steady_timer::time_point::max());
+
+        boost::system::error_code ec;
+        co_await _disk_idle.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    }
+}
+
 std::vector<uint8_t> PieceManager::fetch_my_bitset() const {
     return _my_bitfield;
 }
@@ -56,15 +127,27 @@ void PieceManager::lazy_init(uint32_t piece_index) {
         piece.data.resize(curr_length);
         size_t num_blocks = (curr_length + 16383) / 16384;
         piece.block_status.resize(num_blocks, BlockState::NotRequested);
+        piece.block_persisted.assign(num_blocks, false);
+        piece.block_from.assign(num_blocks, {});
     }
 }
 
 bool PieceManager::verify_hash(uint32_t piece_index) {
+    ScopedLatency timer(_fm.stats().hash);
+
+    // a hybrid missing a piece layer falls back to SHA-1
+    if (has_v2() && !_piece_roots[piece_index].hash.empty()) {
+        const auto& root = _piece_roots[piece_index];
+        auto computed = merkle_root(hash_blocks(piece_index), root.width);
+
+        return std::ranges::equal(computed, root.hash);
+    }
+
     unsigned char digest[SHA_DIGEST_LENGTH];
     const auto& data = _pieces[piece_index].data;
     SHA1(data.data(), data.size(), digest);
 
-    return std::equal(std::begin(digest), std::end(digest), _piece_hashes[piece_index].begin());
+    return std::equal(std::begin(digest), std::end(digest), _piece_hashes.begin() + piece_index * SHA_DIGEST_LENGTH);
 }
 
 // find the length of a piece, by index
@@ -73,11 +156,11 @@ size_t PieceManager::piece_length_for_index(int piece_index) const {
     return piece_index < _num_pieces - 1 ? _piece_length : _total_size - _piece_length * (_num_pieces - 1);
 }
 
-void PieceManager::add_block(uint32_t piece, uint32_t begin, std::span<const unsigned char> block) {
+void PieceManager::add_block(uint32_t piece, uint32_t begin, std::span<const unsigned char> block, const boost::asio::ip::address& from) {
     auto& curr_piece = _pieces[piece];
     auto block_index = begin / 16384;
 
-    if (curr_piece.is_complete) return;
+    if (_stopping || curr_piece.is_complete) return;
     if (block_index >= curr_piece.block_status.size()) return;
 
     auto& curr_block_status = curr_piece.block_status[block_index];
@@ -89,42 +172,350 @@ void PieceManager::add_block(uint32_t piece, uint32_t begin, std::span<const uns
     assert(!curr_piece.data.empty() && "about to copy data into empty piece_data vector");
 
     std::copy(block.begin(), block.end(), curr_piece.data.begin() + begin);
+    curr_piece.block_from[block_index] = from;
+
+    // with the leaf hashes of this piece a bad block is caught on arrival
+    if (_block_hashes.contains(piece) && !block_matches(piece, block_index)) {
+        reject_block(piece, block_index);
+        return;
+    }
+
+    if (curr_piece.blocks_received == curr_piece.block_status.size()) on_piece_filled(piece);
+}
+
+// every block is in, verify and hand off to disk, or start over
+void PieceManager::on_piece_filled(uint32_t piece) {
+    auto& curr_piece = _pieces[piece];
+
+    if (verify_hash(piece)) {
+        curr_piece.is_complete = true;
+
+        // mark as complete in my bitfield
+        set_my_bitfield(piece);
+        _piece_complete_callback(piece);
+        ++_completed_pieces;
 
-    if (curr_piece.blocks_received == curr_piece.block_status.size()) {
-        if (verify_hash(piece)) {
-            curr_piece.is_complete = true;
+        downloaded += curr_piece.data.size();
 
-            // mark as complete in my bitfield
-            set_my_bitfield(piece);
-            _piece_complete_callback(piece);
-            ++_completed_pieces;
+        if (is_complete()) update_access_pattern();
 
-            downloaded += curr_piece.data.size();
+        // std::cout << "Finished " << _completed_pieces << '/' << _num_pieces << '\n';
 
-            // std::cout << "Finished " << _completed_pieces << '/' << _num_pieces << '\n';
+        // fire-and-forget to filemanager
+        boost::asio::co_spawn(
+            _net_exec,
+            write_to_disk(piece, std::move(curr_piece.data)),
+            boost::asio::detached
+        );
 
-            // fire-and-forget to filemanager
-            boost::asio::co_spawn(
-                _disk_exec,
-                _fm.write_piece(piece, std::move(curr_piece.data)),
-                boost::asio::detached
-            );
+        // clear the data immediately to avoid choking up RAM
+        curr_piece.data.clear(); curr_piece.data.shrink_to_fit();
+        curr_piece.block_status.clear(); curr_piece.block_status.shrink_to_fit();
+        curr_piece.block_persisted.clear(); curr_piece.block_persisted.shrink_to_fit();
+        curr_piece.block_from.clear(); curr_piece.block_from.shrink_to_fit();
+        curr_piece.blocks_received = 0;
 
-            // clear the data immediately to avoid choking up RAM
-            curr_piece.data.clear(); curr_piece.data.shrink_to_fit();
-            curr_piece.block_status.clear(); curr_piece.block_status.shrink_to_fit();
-            curr_piece.blocks_received = 0;
+        if (has_v2()) {
+            _block_hashes.erase(piece);
+            _hash_state[piece] = HashState::None;
         }
-        else {
-            // reset block
-            curr_piece.data.clear();
-            curr_piece.block_status.clear();
-            curr_piece.is_complete = false;
-            curr_piece.blocks_received = 0;
+    }
+    else {
+        // pin the failure on the blocks that are wrong and fetch only those again
+        if (_block_hashes.contains(piece)) {
+            bool rejected = false;
+
+            for (size_t j{}; j < curr_piece.block_status.size(); ++j) {
+                if (block_matches(piece, j)) continue;
+
+                reject_block(piece, j);
+                rejected = true;
+            }
+
+            if (rejected) return;
+
+            // hashes we checked against the piece root said otherwise, don't trust them again
+            _block_hashes.erase(piece);
+        }
+
+        // without leaf hashes the whole piece goes, ask peers for them so the next failure costs a block
+        if (has_v2()) {
+            const auto& root = _piece_roots[piece];
+            if (!root.hash.empty() && root.width >= 2 && root.width <= MAX_HASHES_PER_REQUEST && _hash_state[piece] == HashState::None) _hash_state[piece] = HashState::Wanted;
         }
+
+        // reset block
+        curr_piece.data.clear();
+        curr_piece.block_status.clear();
+        curr_piece.block_persisted.clear();
+        curr_piece.block_from.clear();
+        curr_piece.is_complete = false;
+        curr_piece.blocks_received = 0;
     }
 }
 
+// leaf hashes over the file's bytes in the piece, the last block of a file is hashed short
+std::vector<Sha256> PieceManager::hash_blocks(uint32_t piece_index) const {
+    const auto& root = _piece_roots[piece_index];
+    std::span<const unsigned char> data = _pieces[piece_index].data;
+
+    std::vector<Sha256> leaves;
+    leaves.reserve((root.length + MERKLE_BLOCK_SIZE - 1) / MERKLE_BLOCK_SIZE);
+
+    for (size_t offset{}; offset < root.length; offset += MERKLE_BLOCK_SIZE) leaves.push_back(sha256(data.subspan(offset, std::min<size_t>(MERKLE_BLOCK_SIZE, root.length - offset))));
+
+    return leaves;
+}
+
+bool PieceManager::block_matches(uint32_t piece_index, size_t block_index) const {
+    const auto& root = _piece_roots[piece_index];
+    const auto& expected = _block_hashes.at(piece_index);
+
+    // padding after the end of the file, nothing to check
+    auto offset = block_index * MERKLE_BLOCK_SIZE;
+    if (offset >= root.length || block_index >= expected.size()) return true;
+
+    auto data = std::span<const unsigned char>(_pieces[piece_index].data).subspan(offset, std::min<size_t>(MERKLE_BLOCK_SIZE, root.length - offset));
+    return sha256(data) == expected[block_index];
+}
+
+// throw a bad block away and blame whoever sent it
+void PieceManager::reject_block(uint32_t piece_index, size_t block_index) {
+    auto& piece = _pieces[piece_index];
+    if (piece.block_status[block_index] != BlockState::Received) return;
+
+    piece.block_status[block_index] = BlockState::NotRequested;
+    piece.block_persisted[block_index] = false;
+    --piece.blocks_received;
+
+    const auto& from = piece.block_from[block_index];
+    if (!from.is_unspecified()) ++_hash_failures[from];
+}
+
+uint32_t PieceManager::hash_failures(const boost::asio::ip::address& peer) const {
+    auto it = _hash_failures.find(peer);
+    return it == _hash_failures.end() ? 0 : it->second;
+}
+
+// we only ever ask for the leaves of one whole piece, so a request maps back to exactly one piece
+std::optional<uint32_t> PieceManager::piece_for(const HashRequest& request) const {
+    if (!has_v2() || request.root.size() != 32 || request.base_layer != 0) return std::nullopt;
+
+    auto it = _first_piece.find(std::string_view(reinterpret_cast<const char*>(request.root.data()), 32));
+    if (it == _first_piece.end()) return std::nullopt;
+
+    auto width = _piece_roots[it->second].width;
+    if (request.length != width || request.index % width != 0) return std::nullopt;
+
+    auto piece = it->second + request.index / width;
+    if (piece >= _num_pieces || !std::ranges::equal(_piece_roots[piece].file_root, request.root)) return std::nullopt;
+
+    return piece;
+}
+
+std::optional<HashRequest> PieceManager::next_hash_request(const boost::dynamic_bitset<>& peer_bitfield) {
+    if (!has_v2()) return std::nullopt;
+
+    for (uint32_t i{}; i < _num_pieces; ++i) {
+        if (_hash_state[i] != HashState::Wanted || !peer_bitfield.test(i)) continue;
+
+        _hash_state[i] = HashState::Requested;
+
+        const auto& root = _piece_roots[i];
+        return HashRequest{ root.file_root, 0, root.first_block, root.width, 0 };
+    }
+
+    return std::nullopt;
+}
+
+void PieceManager::return_hash_request(const HashRequest& request) {
+    auto piece = piece_for(request);
+    if (piece && _hash_state[*piece] == HashState::Requested) _hash_state[*piece] = HashState::Wanted;
+}
+
+// leaves are only kept if they hash up to the piece layer entry we already trust
+void PieceManager::add_hashes(const HashRequest& header, std::span<const unsigned char> hashes) {
+    auto piece = piece_for(header);
+    if (!piece || _hash_state[*piece] != HashState::Requested) return;
+
+    const auto& root = _piece_roots[*piece];
+    if (hashes.size() < size_t{root.width} * 32) { _hash_state[*piece] = HashState::Wanted; return; }
+
+    std::vector<Sha256> leaves(root.width);
+    for (size_t i{}; i < leaves.size(); ++i) std::copy_n(hashes.begin() + i * 32, 32, leaves[i].begin());
+
+    if (!std::ranges::equal(merkle_root(leaves, root.width), root.hash)) { _hash_state[*piece] = HashState::Wanted; return; }
+
+    _hash_state[*piece] = HashState::None;
+    if (_pieces[*piece].is_complete) return;
+
+    _block_hashes[*piece] = std::move(leaves);
+
+    // blocks of the current attempt can be checked right away
+    auto& curr = _pieces[*piece];
+    for (size_t j{}; j < curr.block_status.size(); ++j) {
+        if (curr.block_status[j] == BlockState::Received && !block_matches(*piece, j)) reject_block(*piece, j);
+    }
+}
+
+// we can answer from the piece layers in the metadata, the leaves of finished pieces would need a disk read and are refused
+std::optional<std::vector<Sha256>> PieceManager::serve_hashes(const HashRequest& request) const {
+    if (!has_v2() || request.root.size() != 32 || request.length < 2 || request.length > MAX_HASHES_PER_REQUEST) return std::nullopt;
+
+    auto it = _first_piece.find(std::string_view(reinterpret_cast<const char*>(request.root.data()), 32));
+    if (it == _first_piece.end()) return std::nullopt;
+
+    std::vector<Sha256> layer;
+    for (auto piece = it->second; piece < _num_pieces && std::ranges::equal(_piece_roots[piece].file_root, request.root); ++piece) {
+        const auto& hash = _piece_roots[piece].hash;
+        if (hash.size() != 32) return std::nullopt;
+
+        layer.emplace_back();
+        std::copy_n(hash.begin(), 32, layer.back().begin());
+    }
+
+    auto height = merkle_height(_piece_roots[it->second].width);
+    if (request.base_layer != height) return std::nullopt;
+
+    return merkle_hashes_with_proof(layer, height, request.index, request.length, request.proof_layers);
+}
+
+std::vector<PartialPieceWrite> PieceManager::collect_partial_pieces() {
+    std::vector<PartialPieceWrite> out;
+
+    for (uint32_t i{}; i < _num_pieces; ++i) {
+        auto& piece = _pieces[i];
+        if (piece.is_complete || piece.blocks_received == 0) continue;
+
+        PartialPieceWrite partial;
+        partial.piece = i;
+        partial.blocks.resize((piece.block_status.size() + 7) / 8);
+
+        for (size_t j{}; j < piece.block_status.size(); ++j) {
+            if (piece.block_status[j] != BlockState::Received) continue;
+
+            partial.blocks[j / 8] |= (1 << (7 - (j % 8)));
+
+            // only blocks that arrived since the last save are written
+            if (!piece.block_persisted[j]) {
+                auto begin = j * 16384;
+                auto end = std::min(begin + 16384, piece.data.size());
+
+                partial.unwritten.emplace_back(static_cast<uint32_t>(begin), std::vector<unsigned char>(piece.data.begin() + begin, piece.data.begin() + end));
+                piece.block_persisted[j] = true;
+            }
+        }
+
+        out.push_back(std::move(partial));
+    }
+
+    return out;
+}
+
+boost::asio::awaitable<void> PieceManager::restore_partial_pieces() {
+    auto pending = std::move(_partial_to_restore);
+
+    for (const auto& partial: pending) {
+        auto index = partial.piece;
+        if (_stopping) co_return;
+        if (index >= _num_pieces || _pieces[index].is_complete) continue;
+
+        auto length = piece_length_for_index(index);
+        auto num_blocks = (length + 16383) / 16384;
+        auto saved = [&](size_t j) { return j / 8 < partial.blocks.size() && ((partial.blocks[j / 8] >> (7 - (j % 8))) & 1); };
+
+        // only the saved blocks are read, a run of them at a time, the rest of the piece may lie past the end of the file
+        size_t j{};
+        while (j < num_blocks) {
+            if (!saved(j)) { ++j; continue; }
+
+            auto first = j;
+            while (j < num_blocks && saved(j)) ++j;
+
+            auto begin = first * 16384;
+            auto end = std::min(j * 16384, length);
+
+            std::optional<std::vector<unsigned char>> data;
+            try {
+                data = co_await boost::asio::co_spawn(_disk_exec, _fm.read_block(index, static_cast<uint32_t>(begin), static_cast<uint32_t>(end - begin)), boost::asio::use_awaitable);
+            }
+            catch (const std::exception& e) {
+                std::println("Could not restore piece {}: {}", index, e.what());
+            }
+
+            // the piece may have been finished by peers while we were reading, blocks that can't be read are fetched again
+            if (_stopping) co_return;
+            if (!data || data->size() != end - begin || _pieces[index].is_complete) continue;
+
+            lazy_init(index);
+            auto& piece = _pieces[index];
+
+            for (auto k = first; k < j; ++k) {
+                if (piece.block_status[k] == BlockState::Received) continue;
+
+                auto from = k * 16384 - begin;
+                auto size = std::min<size_t>(16384, end - begin - from);
+                std::copy_n(data->begin() + from, size, piece.data.begin() + k * 16384);
+
+                // a request still in flight for this block is dropped in add_block when it arrives
+                piece.block_status[k] = BlockState::Received;
+                piece.block_persisted[k] = true;
+                ++piece.blocks_received;
+            }
+        }
+
+        auto& piece = _pieces[index];
+        if (!_stopping && !piece.is_complete && !piece.block_status.empty() && piece.blocks_received == piece.block_status.size()) on_piece_filled(index);
+    }
+}
+
+boost::asio::awaitable<void> PieceManager::recheck_pieces() {
+    auto pending = std::move(_pieces_to_recheck);
+
+    for (auto index: pending) {
+        if (_stopping) co_return;
+
+        auto& piece = _pieces[index];
+        if (piece.is_complete || !piece.block_status.empty()) continue;
+
+        std::optional<std::vector<unsigned char>> data;
+        try {
+            data = co_await boost::asio::co_spawn(_disk_exec, _fm.read_block(index, 0, static_cast<uint32_t>(piece_length_for_index(index))), boost::asio::use_awaitable);
+        }
+        catch (const std::exception& e) {
+            std::println("Could not recheck piece {}: {}", index, e.what());
+        }
+
+        // peers got to the piece while we were reading, it is theirs now
+        if (_stopping) co_return;
+        if (!data || data->size() != piece_length_for_index(index) || piece.is_complete || !piece.block_status.empty()) continue;
+
+        piece.data = std::move(*data);
+        bool valid = verify_hash(index);
+        piece.data.clear(); piece.data.shrink_to_fit();
+
+        if (!valid) continue;
+
+        piece.is_complete = true;
+        set_my_bitfield(index);
+        _piece_complete_callback(index);
+        ++_completed_pieces;
+
+        downloaded += piece_length_for_index(index);
+
+        // the bytes are already on disk, only the resume file has to hear about it
+        boost::asio::post(_disk_exec, [this, index]() { _fm.confirm_piece(index); });
+    }
+
+    if (is_complete()) update_access_pattern();
+}
+
+// pieces are picked in order while downloading, uploads are scattered all over the torrent
+void PieceManager::update_access_pattern() {
+    auto pattern = is_complete() ? AccessPattern::Random : AccessPattern::Sequential;
+    boost::asio::post(_disk_exec, [this, pattern]() { _fm.set_access_pattern(pattern); });
+}
+
 void PieceManager::set_my_bitfield(uint32_t piece) {
     _my_bitfield[piece / 8] |= (1 << (7 - (piece % 8)));
 }
@@ -179,8 +570,12 @@ std::optional<std::tuple<int, int, int>> PieceManager::next_block_request(const
     
     assert(peer_bitfield.size() == _num_pieces && "Bitfield size mismatch");
 
+    // disk is behind, finish the pieces we have open but don't start new ones
+    bool backpressure = _disk_throttled || _fm.write_cache_full();
+
     for (int i{}; i < _num_pieces; ++i) {
         if (_pieces[i].is_complete) continue;
+        if (backpressure && _pieces[i].block_status.empty()) continue;
 
         if (peer_bitfield.test(i)) {
             lazy_init(static_cast<uint32_t>(i));
@@ -0,0 +1,85 @@
+#include "PositionalStorage.hpp"
+
+#include <print>
+
+PositionalStorage::PositionalStorage(FileHandleCache& handles, std::vector<StorageFile> files, AllocationMode allocation, bool direct):
+    BaseStorage(std::move(files), allocation), _handles(handles), _direct(direct), _dirty(_files.size()) {}
+
+// the files may be deleted next, don't leave them open in the cache
+PositionalStorage::~PositionalStorage() {
+    for (const auto& file: _files) _handles.close(file.path);
+}
+
+// files are opened on first use, adding a torrent with thousands of files touches none of them
+std::shared_ptr<FileHandle> PositionalStorage::open_for_write(size_t file_index) {
+    auto file = _handles.open(_files[file_index].path, true, _direct);
+
+    // only the first write into a directory finds it missing
+    if (!file) {
+        create_parent_directories(file_index);
+        file = _handles.open(_files[file_index].path, true, _direct);
+    }
+
+    if (!file) {
+        std::println("Could not open {}", _files[file_index].path.string());
+        return nullptr;
+    }
+
+    allocate(file_index, file->handle);
+
+    std::lock_guard lock(_dirty_mutex);
+    _dirty[file_index] = true;
+
+    return file;
+}
+
+// fsync through any handle flushes the file, not just what was written through that handle
+void PositionalStorage::sync() {
+    std::vector<size_t> dirty;
+
+    {
+        std::lock_guard lock(_dirty_mutex);
+        for (size_t i{}; i < _dirty.size(); ++i) {
+            if (_dirty[i]) dirty.push_back(i);
+            _dirty[i] = false;
+        }
+    }
+
+    for (auto index: dirty) {
+        if (auto file = _handles.open(_files[index].path, true, _direct)) sync_native(file->handle);
+    }
+}
+
+boost::asio::awaitable<bool> PositionalStorage::write_at(size_t file_index, uint64_t file_offset, std::span<const unsigned char> data) {
+    auto file = open_for_write(file_index);
+
+    if (!file || !positional_write(file->handle, file_offset, data)) {
+        std::println("Write to {} failed", _files[file_index].path.string());
+        co_return false;
+    }
+
+    co_return true;
+}
+
+// a read never creates anything, there is no data in a file that was never written
+std::shared_ptr<FileHandle> PositionalStorage::open_for_read(size_t file_index) {
+    return _handles.open(_files[file_index].path, false, _direct);
+}
+
+boost::asio::awaitable<bool> PositionalStorage::read_at(size_t file_index, uint64_t file_offset, std::span<unsigned char> out) {
+    auto file = open_for_read(file_index);
+    if (!file) co_return false;
+
+    co_return positional_read(file->handle, file_offset, out);
+}
+
+boost::asio::awaitable<bool> PositionalStorage::write_vectored_at(size_t file_index, uint64_t file_offset, std::span<const std::span<const unsigned char>> buffers) {
+    auto file = open_for_write(file_index);
+
+    if (!file || !positional_writev(file->handle, file_offset, buffers)) {
+        std::println("Write to {} failed", _files[file_index].path.string());
+        co_return false;
+    }
+
+    co_return true;
+}
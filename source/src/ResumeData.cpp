@@ -0,0 +1,111 @@
+#include "ResumeData.hpp"
+
+#include <cstring>
+#include <boost/endian.hpp>
+
+namespace {
+    constexpr char MAGIC[4] = { 'C', 'T', 'R', 'S' };
+
+    uint32_t fnv1a(std::span<const unsigned char> data) {
+        uint32_t hash = 2166136261u;
+        for (auto b: data) {
+            hash ^= b;
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    template <typename T>
+    void put(std::vector<unsigned char>& out, T value) {
+        boost::endian::native_to_little_inplace(value);
+        auto* p = reinterpret_cast<const unsigned char*>(&value);
+        out.insert(out.end(), p, p + sizeof(T));
+    }
+
+    struct Reader {
+        std::span<const unsigned char> in;
+        size_t pos{};
+
+        template <typename T>
+        bool get(T& value) {
+            if (pos + sizeof(T) > in.size()) return false;
+            std::memcpy(&value, in.data() + pos, sizeof(T));
+            boost::endian::little_to_native_inplace(value);
+            pos += sizeof(T);
+            return true;
+        }
+
+        bool bytes(std::vector<uint8_t>& out, size_t n) {
+            if (pos + n > in.size()) return false;
+            out.assign(in.begin() + pos, in.begin() + pos + n);
+            pos += n;
+            return true;
+        }
+    };
+}
+
+std::vector<unsigned char> serialize_resume(const ResumeData& data) {
+    std::vector<unsigned char> out;
+    out.reserve(32 + data.files.size() * 16 + data.bitfield.size());
+
+    out.insert(out.end(), std::begin(MAGIC), std::end(MAGIC));
+    put(out, ResumeData::VERSION);
+    put(out, data.num_pieces);
+    put(out, data.piece_length);
+
+    put(out, static_cast<uint32_t>(data.files.size()));
+    for (const auto& file: data.files) {
+        put(out, file.size);
+        put(out, file.mtime);
+    }
+
+    put(out, static_cast<uint32_t>(data.bitfield.size()));
+    out.insert(out.end(), data.bitfield.begin(), data.bitfield.end());
+
+    put(out, static_cast<uint32_t>(data.partial.size()));
+    for (const auto& partial: data.partial) {
+        put(out, partial.piece);
+        put(out, static_cast<uint32_t>(partial.blocks.size()));
+        out.insert(out.end(), partial.blocks.begin(), partial.blocks.end());
+    }
+
+    put(out, fnv1a(out));
+    return out;
+}
+
+std::optional<ResumeData> parse_resume(std::span<const unsigned char> in) {
+    if (in.size() < sizeof(MAGIC) + 4 || std::memcmp(in.data(), MAGIC, sizeof(MAGIC)) != 0) return std::nullopt;
+
+    // checksum covers everything before it, a partially written file fails here
+    uint32_t stored;
+    std::memcpy(&stored, in.data() + in.size() - 4, 4);
+    boost::endian::little_to_native_inplace(stored);
+    if (stored != fnv1a(in.first(in.size() - 4))) return std::nullopt;
+
+    Reader r{ in.first(in.size() - 4), sizeof(MAGIC) };
+    ResumeData out;
+
+    uint32_t version, num_files, bitfield_len, num_partial;
+
+    if (!r.get(version) || version != ResumeData::VERSION) return std::nullopt;
+    if (!r.get(out.num_pieces) || !r.get(out.piece_length)) return std::nullopt;
+
+    if (!r.get(num_files)) return std::nullopt;
+    out.files.resize(num_files);
+    for (auto& file: out.files) {
+        if (!r.get(file.size) || !r.get(file.mtime)) return std::nullopt;
+    }
+
+    if (!r.get(bitfield_len) || bitfield_len != (out.num_pieces + 7) / 8) return std::nullopt;
+    if (!r.bytes(out.bitfield, bitfield_len)) return std::nullopt;
+
+    if (!r.get(num_partial)) return std::nullopt;
+    out.partial.resize(num_partial);
+    for (auto& partial: out.partial) {
+        uint32_t mask_len;
+        if (!r.get(partial.piece) || partial.piece >= out.num_pieces || !r.get(mask_len)) return std::nullopt;
+        if (!r.bytes(partial.blocks, mask_len)) return std::nullopt;
+    }
+
+    return out;
+}
@@ -0,0 +1,17 @@
+#include "StorageFactory.hpp"
+#include "PositionalStorage.hpp"
+#include "MmapStorage.hpp"
+#include "AsyncFileStorage.hpp"
+#include "DirectStorage.hpp"
+
+std::unique_ptr<BaseStorage> make_storage(boost::asio::any_io_executor disk_exec, FileHandleCache& handles, StorageMode mode, AllocationMode allocation, std::vector<StorageFile> files) {
+    if (mode == StorageMode::Mmap) return std::make_unique<MmapStorage>(std::move(files), allocation);
+    if (mode == StorageMode::Direct) return std::make_unique<DirectStorage>(handles, std::move(files), allocation);
+
+#if defined(BOOST_ASIO_HAS_FILE) && !defined(_WIN32)
+    if (mode == StorageMode::AsyncFile) return std::make_unique<AsyncFileStorage>(disk_exec, handles, std::move(files), allocation);
+#endif
+
+    // the default, and the fallback when async file support is compiled out
+    return std::make_unique<PositionalStorage>(handles, std::move(files), allocation);
+}
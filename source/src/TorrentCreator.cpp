@@ -0,0 +1,265 @@
+#include "TorrentCreator.hpp"
+#include "BEncodeWriter.hpp"
+#include "NativeFile.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <print>
+#include <thread>
+#include <chrono>
+#include <ranges>
+#include <algorithm>
+#include <stdexcept>
+
+#include <openssl/sha.h>
+
+namespace {
+    constexpr uint64_t MIN_PIECE_LENGTH = 16 * 1024;
+    constexpr uint64_t MAX_PIECE_LENGTH = 16 * 1024 * 1024;
+    constexpr uint64_t TARGET_PIECES = 2000;
+
+    // pieces a worker takes at once, large enough that its reads stay sequential
+    constexpr uint64_t CHUNK_BYTES = 32 * 1024 * 1024;
+
+    // keeps the file the last read ended in open, pieces are read in order so it is usually the next one needed
+    class FileReader {
+    public:
+        FileReader(const std::filesystem::path& base, const std::vector<TorrentFile>& files, const std::vector<uint64_t>& offsets): _base(base), _files(files), _offsets(offsets) {}
+        ~FileReader() { if (_handle != invalid_native_handle) close_native(_handle); }
+
+        FileReader(const FileReader&) = delete;
+        FileReader& operator=(const FileReader&) = delete;
+
+        void read(uint64_t offset, std::span<unsigned char> out) {
+            auto index = static_cast<size_t>(std::ranges::upper_bound(_offsets, offset) - _offsets.begin()) - 1;
+
+            while (!out.empty()) {
+                const auto& file = _files[index];
+                auto file_offset = offset - _offsets[index];
+                auto take = std::min<uint64_t>(out.size(), file.length - file_offset);
+
+                if (take > 0) {
+                    if (index != _open) open(index);
+                    if (!positional_read(_handle, file_offset, out.first(take))) throw std::runtime_error("Could not read " + (_base / file.path).string());
+                }
+
+                out = out.subspan(take);
+                offset += take;
+                ++index;
+            }
+        }
+
+    private:
+        void open(size_t index) {
+            if (_handle != invalid_native_handle) close_native(_handle);
+
+            _handle = open_native(_base / _files[index].path, false);
+            _open = index;
+
+            if (_handle == invalid_native_handle) throw std::runtime_error("Could not open " + (_base / _files[index].path).string());
+        }
+
+        const std::filesystem::path& _base;
+        const std::vector<TorrentFile>& _files;
+        const std::vector<uint64_t>& _offsets;
+
+        native_handle_t _handle = invalid_native_handle;
+        size_t _open = SIZE_MAX;
+    };
+
+    std::vector<unsigned char> hash_pieces(const std::filesystem::path& base, const std::vector<TorrentFile>& files, uint64_t total_size, uint64_t piece_length, unsigned threads) {
+        std::vector<uint64_t> offsets;
+        uint64_t offset{};
+        for (const auto& file: files) { offsets.push_back(offset); offset += file.length; }
+
+        auto num_pieces = (total_size + piece_length - 1) / piece_length;
+        std::vector<unsigned char> hashes(num_pieces * SHA_DIGEST_LENGTH);
+
+        auto chunk = std::max<uint64_t>(1, CHUNK_BYTES / piece_length);
+        std::atomic<uint64_t> next{};
+
+        // workers poll failed, error is only touched under the lock
+        std::atomic<bool> failed{};
+        std::mutex error_mutex;
+        std::exception_ptr error;
+
+        auto worker = [&] {
+            try {
+                FileReader reader(base, files, offsets);
+                std::vector<unsigned char> buffer(piece_length);
+
+                for (auto first = next.fetch_add(chunk); first < num_pieces && !failed; first = next.fetch_add(chunk)) {
+                    for (auto piece = first; piece < std::min(first + chunk, num_pieces); ++piece) {
+                        auto start = piece * piece_length;
+                        auto length = std::min(piece_length, total_size - start);
+
+                        reader.read(start, std::span(buffer).first(length));
+                        SHA1(buffer.data(), length, hashes.data() + piece * SHA_DIGEST_LENGTH);
+                    }
+                }
+            }
+            catch (...) {
+                std::lock_guard lock(error_mutex);
+                if (!error) error = std::current_exception();
+                failed = true;
+            }
+        };
+
+        {
+            std::vector<std::jthread> workers;
+            for (unsigned i{}; i < threads; ++i) workers.emplace_back(worker);
+        }
+
+        if (error) std::rethrow_exception(error);
+        return hashes;
+    }
+}
+
+uint64_t choose_piece_length(uint64_t total_size) {
+    auto length = MIN_PIECE_LENGTH;
+    while (length < MAX_PIECE_LENGTH && total_size / length > TARGET_PIECES) length *= 2;
+    return length;
+}
+
+std::vector<TorrentFile> collect_files(const std::filesystem::path& source, bool follow_symlinks) {
+    if (std::filesystem::is_regular_file(source)) return { { source.filename().string(), std::filesystem::file_size(source) } };
+    if (!std::filesystem::is_directory(source)) throw std::runtime_error("No such file or directory: " + source.string());
+
+    std::vector<TorrentFile> files;
+
+    for (const auto& entry: std::filesystem::recursive_directory_iterator(source)) {
+        if (!entry.is_regular_file() || (!follow_symlinks && entry.is_symlink())) continue;
+        files.push_back({ entry.path().lexically_relative(source).generic_string(), entry.file_size() });
+    }
+
+    if (files.empty()) throw std::runtime_error("Nothing to share in " + source.string());
+
+    std::ranges::sort(files, {}, &TorrentFile::path);
+    return files;
+}
+
+CreatedTorrent create_torrent(const CreateTorrentOptions& options) {
+    auto source = std::filesystem::absolute(options.source).lexically_normal();
+    if (!source.has_filename()) source = source.parent_path();
+
+    auto files = collect_files(source, options.follow_symlinks);
+    bool single = std::filesystem::is_regular_file(source);
+
+    CreatedTorrent out;
+    out.name = source.filename().string();
+    out.num_files = files.size();
+
+    for (const auto& file: files) out.total_size += file.length;
+    if (out.total_size == 0) throw std::runtime_error("Every file in " + source.string() + " is empty");
+
+    out.piece_length = options.piece_length ? options.piece_length : choose_piece_length(out.total_size);
+    if (out.piece_length < MIN_PIECE_LENGTH || out.piece_length > MAX_PIECE_LENGTH || (out.piece_length & (out.piece_length - 1)) != 0) throw std::runtime_error("Piece length must be a power of two from 16 KiB to 16 MiB");
+
+    // every worker holds a piece sized buffer, more of them than cores only costs memory
+    auto cores = std::max(1u, std::thread::hardware_concurrency());
+    auto threads = options.threads ? std::min(options.threads, cores) : cores;
+    auto base = single ? source.parent_path() : source;
+
+    auto started = std::chrono::steady_clock::now();
+    auto hashes = hash_pieces(base, files, out.total_size, out.piece_length, threads);
+    out.num_pieces = hashes.size() / SHA_DIGEST_LENGTH;
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::println("Hashed {} in {} pieces on {} threads, {:.1f} MiB/s", out.name, out.num_pieces, threads, out.total_size / 1048576.0 / std::max(elapsed, 1e-3));
+
+    static_assert(bencode_keys_sorted({ "files", "length", "name", "piece length", "pieces", "private" }));
+
+    auto info = bencode([&](auto& w) {
+        w.begin_dict();
+
+        if (!single) {
+            w.key("files");
+            w.begin_list();
+
+            for (const auto& file: files) {
+                w.begin_dict();
+                w.entry("length", static_cast<int64_t>(file.length));
+
+                w.key("path");
+                w.begin_list();
+                for (auto part: file.path | std::views::split('/')) w.string(std::string_view(part.begin(), part.end()));
+                w.end();
+
+                w.end();
+            }
+
+            w.end();
+        }
+        else w.entry("length", static_cast<int64_t>(out.total_size));
+
+        w.entry("name", out.name);
+        w.entry("piece length", static_cast<int64_t>(out.piece_length));
+        w.key("pieces"); w.string(hashes);
+        if (options.is_private) w.entry("private", 1);
+
+        w.end();
+    });
+
+    std::array<unsigned char, 20> info_hash;
+    SHA1(reinterpret_cast<const unsigned char*>(info.data()), info.size(), info_hash.data());
+
+    static const char* hex = "0123456789abcdef";
+    for (auto b: info_hash) {
+        out.info_hash_hex += hex[b >> 4];
+        out.info_hash_hex += hex[b & 0xF];
+    }
+
+    static_assert(bencode_keys_sorted({ "announce", "announce-list", "comment", "created by", "creation date", "info" }));
+
+    auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    out.data = bencode([&](auto& w) {
+        w.begin_dict();
+
+        if (!options.trackers.empty()) w.entry("announce", options.trackers.front());
+
+        if (options.trackers.size() > 1) {
+            w.key("announce-list");
+            w.begin_list();
+            for (const auto& tracker: options.trackers) {
+                w.begin_list();
+                w.string(tracker);
+                w.end();
+            }
+            w.end();
+        }
+
+        if (!options.comment.empty()) w.entry("comment", options.comment);
+        w.entry("created by", "ctorrent");
+        w.entry("creation date", static_cast<int64_t>(now));
+
+        // the info dict goes in exactly as it was hashed
+        w.key("info");
+        w.raw(std::string_view(info.data(), info.size()));
+
+        w.end();
+    });
+
+    return out;
+}
+
+boost::asio::awaitable<CreatedTorrent> async_create_torrent(boost::asio::any_io_executor pool, CreateTorrentOptions options) {
+    co_return co_await boost::asio::async_initiate<decltype(boost::asio::use_awaitable), void(std::exception_ptr, CreatedTorrent)>(
+        [pool](auto handler, CreateTorrentOptions options) {
+            boost::asio::post(pool, [handler = std::move(handler), options = std::move(options)]() mutable {
+                CreatedTorrent result;
+                std::exception_ptr error;
+
+                try { result = create_torrent(options); }
+                catch (...) { error = std::current_exception(); }
+
+                // complete on the caller's executor, not on this thread
+                auto exec = boost::asio::get_associated_executor(handler);
+                boost::asio::post(exec, [handler = std::move(handler), error, result = std::move(result)]() mutable {
+                    std::move(handler)(error, std::move(result));
+                });
+            });
+        },
+        boost::asio::use_awaitable, std::move(options)
+    );
+}
@@ -5,23 +5,43 @@
 #include "PeerSnapshot.hpp"
 #include "TrackerSnapshot.hpp"
 #include "NetworkCapabilities.hpp"
+#include "AnnounceScheduler.hpp"
 
 #include <iostream>
+#include <algorithm>
 #include <ranges>
 #include <filesystem>
 #include <print>
 #include <unordered_set>
 
+#include <boost/asio/experimental/awaitable_operators.hpp>
+
+using namespace boost::asio::experimental::awaitable_operators;
+
 const std::string_view& TorrentSession::name() const { return _metadata.name; }
 
-TorrentSession::TorrentSession(boost::asio::any_io_executor net_exec, boost::asio::any_io_executor disk_exec, Metadata&& md, const NetworkCapabilities& nc): 
+TorrentSession::TorrentSession(boost::asio::any_io_executor net_exec, boost::asio::any_io_executor disk_exec, FileHandleCache& file_handles, DiskScheduler& disk_scheduler, Metadata&& md, const NetworkCapabilities& nc, UdpTrackerMux& udp_mux, HttpConnectionPool& http_pool, DnsCache& dns, AnnounceScheduler& announce_scheduler, StorageMode storage_mode, AllocationMode allocation): 
     _net_exec(net_exec), 
     _disk_exec(disk_exec),
     peer_list_strand(boost::asio::make_strand(_net_exec)),
+    resume_timer(_net_exec),
+    _background_done(_net_exec, boost::asio::steady_timer::time_point::max()),
+    _announce_timer(_net_exec),
+    _announce_deadline(_net_exec),
+    _announce_loop_done(_net_exec, boost::asio::steady_timer::time_point::max()),
     _metadata(std::move(md)),
-    _fm(std::filesystem::current_path(), _metadata.name, _metadata.files, _metadata.total_size, _metadata.piece_length),
+    _fm(_disk_exec, file_handles, disk_scheduler, std::filesystem::current_path(), _metadata.name, _metadata.files, _metadata.total_size, _metadata.piece_length, storage_mode, allocation),
+    _pm(_net_exec, _disk_exec, _metadata.num_pieces(), _metadata.piece_length, _metadata.total_size, _metadata.piece_hashes, _metadata.piece_roots, _fm, [this](uint32_t piece) {
+        boost::asio::co_spawn(_net_exec, broadcast_have(piece), boost::asio::detached);
+
+        // the piece isn't counted until the callback returns
+        boost::asio::post(_net_exec, [this] { check_completed(); });
+    }),
     _nc(nc),
-    _pm(_disk_exec, _metadata.piece_hashes.size(), _metadata.piece_length, _metadata.total_size, _metadata.piece_hashes, _fm, [this](uint32_t piece) { boost::asio::co_spawn(_net_exec, broadcast_have(piece), boost::asio::detached); })
+    _udp_mux(udp_mux),
+    _http_pool(http_pool),
+    _dns(dns),
+    _announce_scheduler(announce_scheduler)
     {
         build_tracker_list();
     }
@@ -39,7 +59,7 @@ boost::asio::awaitable<void> TorrentSession::on_tracker_response(const TrackerRe
 
         if (inserted) {
             it->second = std::make_shared<PeerConnection>(
-                _net_exec, peer, _metadata.info_hash, peer_id, _metadata.piece_hashes.size(), _pm, PeerDirection::Outbound
+                _net_exec, peer, _metadata.info_hash, peer_id, _metadata.num_pieces(), _pm, PeerDirection::Outbound
             );
 
             boost::asio::co_spawn(_net_exec, run_peer(it->second), boost::asio::detached);
@@ -50,17 +70,74 @@ boost::asio::awaitable<void> TorrentSession::on_tracker_response(const TrackerRe
 }
 
 void TorrentSession::start() {
-    for (auto& state: _tracker_list) boost::asio::co_spawn(_net_exec, tracker_loop(state), boost::asio::detached);
+    spawn_background(startup());
+}
+
+boost::asio::awaitable<void> TorrentSession::startup() {
+    co_await _pm.load_resume();
+    if (session_stopped) co_return;
+
+    _resume_loaded = true;
+    _was_complete = _pm.is_complete();
+
+    _announce_loop_running = true;
+    boost::asio::co_spawn(_net_exec, announce_loop(), boost::asio::detached);
+    spawn_background(resume_loop());
+
+    // blocks of unfinished pieces saved by the last run, and pieces in files changed since
+    spawn_background(_pm.restore_partial_pieces());
+    spawn_background(_pm.recheck_pieces());
+}
+
+// counted before it is spawned, so a stop() right after start() still waits for it
+void TorrentSession::spawn_background(boost::asio::awaitable<void> task) {
+    ++_background_running;
+
+    boost::asio::co_spawn(_net_exec, std::move(task), [this](std::exception_ptr e) {
+        if (e) {
+            try { std::rethrow_exception(e); }
+            catch (const std::exception& ex) { std::println("Session task failed: {}", ex.what()); }
+        }
+
+        if (--_background_running == 0) _background_done.cancel();
+    });
 }
 
 boost::asio::awaitable<void> TorrentSession::stop() {
     session_stopped = true;
+    _pm.request_stop();
+
+    _announce_timer.cancel();
+    _announce_deadline.cancel();
+    resume_timer.cancel();
+
+    // let the loop's announce unwind first, a tracker shouldn't get stopped while it still has one of ours in flight
+    if (_announce_loop_running) {
+        boost::system::error_code ec;
+        co_await _announce_loop_done.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    }
 
-    // cancel trackers
+    // trackers that know about us are told we're leaving, each gets STOP_ANNOUNCE_TIMEOUT to take it
     for (auto& state: _tracker_list) {
-        state._tracker_shared_ptr->stop();
-        state.timer.cancel();
+        if (state.started) co_await announce_to(state, TrackerEvent::Stopped);
     }
+
+    for (auto& state: _tracker_list) state._tracker_shared_ptr->stop();
+
+    // a resume save already running gets to finish, the startup restore and recheck give up at their next step
+    while (_background_running > 0) {
+        boost::system::error_code ec;
+        co_await _background_done.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    }
+
+    // pieces verified but still on their way to the write cache have to land before the last flush
+    // once this returns no upload read is at the disk either, the file manager's scheduler client can go with the session
+    co_await _pm.drain_disk();
+
+    // write out verified pieces still sitting in the write cache, then commit them
+    co_await boost::asio::co_spawn(_disk_exec, _fm.save_partial(_pm.collect_partial_pieces()), boost::asio::use_awaitable);
+    co_await boost::asio::co_spawn(_disk_exec, _fm.close(), boost::asio::use_awaitable);
+    co_await boost::asio::co_spawn(_disk_exec, _fm.save_resume(), boost::asio::use_awaitable);
     co_return;
 }
 
@@ -88,59 +165,202 @@ boost::asio::awaitable<void> TorrentSession::broadcast_have(uint32_t piece) {
     }
 }
 
-boost::asio::awaitable<void> TorrentSession::tracker_loop(TrackerState& state) {
+boost::asio::awaitable<void> TorrentSession::announce_loop() {
     while (!session_stopped) {
-        try {
-            auto resp = co_await state._tracker_shared_ptr->async_announce(peer_id, _pm.downloaded_bytes(), _pm.uploaded_bytes(), _pm.total_bytes());
-            co_await on_tracker_response(resp);
+        co_await announce_once();
+
+        // the timer is cancelled to announce early, when the download completes
+        while (!session_stopped) {
+            _announce_timer.expires_at(_next_announce);
+
+            boost::system::error_code ec;
+            co_await _announce_timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+            if (!ec) break;
+        }
+    }
+
+    _announce_loop_running = false;
+    _announce_loop_done.cancel();
+}
+
+// BEP 12, tiers are tried in order and the trackers of a tier one by one, the first to answer is the one we use
+boost::asio::awaitable<void> TorrentSession::announce_once() {
+    bool completed = _completed_pending;
+    TrackerState* answered = nullptr;
+
+    for (auto& tier: _tiers) {
+        for (auto it = tier.begin(); it != tier.end() && !answered; ++it) {
+            if (session_stopped) co_return;
+
+            auto& state = _tracker_list[*it];
+            auto event = !state.started ? TrackerEvent::Started : completed ? TrackerEvent::Completed : TrackerEvent::None;
+
+            if (!co_await announce_to(state, event)) continue;
+
+            // it's tried first from now on
+            std::rotate(tier.begin(), it, std::next(it));
+            answered = &state;
+        }
+
+        if (answered) break;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    _last_announce = now;
+
+    if (answered) {
+        _next_announce = now + std::chrono::seconds(answered->stats.interval);
+        if (completed) _completed_pending = false;
+    }
+    else _next_announce = now + std::chrono::seconds(DEFAULT_ANNOUNCE_TIMER);
+
+    // finished while we were announcing, don't sit on it for a whole interval
+    if (answered && _completed_pending) _next_announce = std::min(_next_announce, now + std::chrono::seconds(_min_interval));
+
+    for (auto& state: _tracker_list) state.stats.next_announce = _next_announce;
+}
+
+boost::asio::awaitable<bool> TorrentSession::announce_to(TrackerState& state, TrackerEvent event) {
+    auto& tracker = *state._tracker_shared_ptr;
 
-            state.stats.peers_returned = resp.peers.size();
-            state.stats.interval = resp.interval.value_or(DEFAULT_ANNOUNCE_TIMER);
+    // stopped goes out on the way out, pacing it would only hold up shutdown
+    if (event != TrackerEvent::Stopped) {
+        auto slot = co_await _announce_scheduler.acquire(tracker.host());
 
-            state.stats.status = resp.error;
-            if (!resp.error.empty()) state.stats.reachable = false;
-            else state.stats.reachable = true;
+        // the slot is waited for on the deadline timer, stop() cancels it, checked first in case it already did
+        if (session_stopped) co_return false;
 
-            state.stats.next_announce =
-                std::chrono::steady_clock::now() +
-                std::chrono::seconds(state.stats.interval);
+        if (slot > std::chrono::steady_clock::now()) {
+            _announce_deadline.expires_at(slot);
+
+            boost::system::error_code ec;
+            co_await _announce_deadline.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
         }
-        catch (const std::exception& e) {
-            state.stats.reachable = false;
-            state.stats.status = e.what();
-            state.stats.peers_returned = 0;
-            state.stats.interval = DEFAULT_ANNOUNCE_TIMER;
-
-            state.stats.next_announce =
-                std::chrono::steady_clock::now() +
-                std::chrono::seconds(DEFAULT_ANNOUNCE_TIMER);
+
+        if (session_stopped) co_return false;
+    }
+
+    try {
+        _announce_deadline.expires_after(event == TrackerEvent::Stopped ? STOP_ANNOUNCE_TIMEOUT : ANNOUNCE_TIMEOUT);
+
+        // whichever finishes first cancels the other
+        boost::system::error_code ec;
+        auto result = co_await (
+            tracker.async_announce(peer_id, _pm.downloaded_bytes(), _pm.uploaded_bytes(), _pm.total_bytes(), event) ||
+            _announce_deadline.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec))
+        );
+
+        if (result.index() == 1) throw std::runtime_error(session_stopped && event != TrackerEvent::Stopped ? "Announce cancelled" : "Tracker timed out");
+        auto& resp = std::get<0>(result);
+
+        state.stats.peers_returned = resp.peers.size();
+        state.stats.interval = resp.interval.value_or(DEFAULT_ANNOUNCE_TIMER);
+        state.stats.status = resp.error;
+        state.stats.reachable = resp.error.empty();
+
+        if (!resp.error.empty()) {
+            std::println("Warning: {}", resp.error);
+            co_return false;
         }
 
-        state.timer.expires_at(state.stats.next_announce);
+        state.started = event != TrackerEvent::Stopped;
+        if (event == TrackerEvent::Stopped) co_return true;
+
+        _min_interval = resp.min_interval.value_or(0);
+        co_await on_tracker_response(resp);
+    }
+    catch (const std::exception& e) {
+        state.stats.reachable = false;
+        state.stats.status = e.what();
+        state.stats.peers_returned = 0;
+        state.stats.interval = DEFAULT_ANNOUNCE_TIMER;
+
+        co_return false;
+    }
+
+    co_return true;
+}
+
+void TorrentSession::check_completed() {
+    if (session_stopped || _was_complete || !_pm.is_complete()) return;
+
+    _was_complete = true;
+    _completed_pending = true;
+
+    // announce now, unless the tracker asked us to hold off
+    _next_announce = std::max(std::chrono::steady_clock::now(), _last_announce + std::chrono::seconds(_min_interval));
+    _announce_timer.cancel();
+}
+
+boost::asio::awaitable<void> TorrentSession::resume_loop() {
+    sample_disk_rates();
+    auto next_save = std::chrono::steady_clock::now() + RESUME_SAVE_INTERVAL;
+
+    while (!session_stopped) {
+        resume_timer.expires_after(STATS_INTERVAL);
 
         boost::system::error_code ec;
-        co_await state.timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        co_await resume_timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
         if (ec || session_stopped) break;
+
+        sample_disk_rates();
+
+        auto now = std::chrono::steady_clock::now();
+        if (now < next_save) continue;
+        next_save = now + RESUME_SAVE_INTERVAL;
+
+        co_await boost::asio::co_spawn(_disk_exec, _fm.save_partial(_pm.collect_partial_pieces()), boost::asio::use_awaitable);
+        co_await boost::asio::co_spawn(_disk_exec, _fm.save_resume(), boost::asio::use_awaitable);
     }
 }
 
 void TorrentSession::build_tracker_list() {
     std::unordered_set<std::string_view> seen;
     
-    auto add = [&](std::string_view url) {
+    auto add = [&](std::vector<size_t>& tier, std::string_view url) {
         if (!url.empty() && !seen.contains(url)) {
             seen.insert(url);
-            _tracker_list.emplace_back(make_tracker(_net_exec, url, _metadata.info_hash, _nc), _net_exec);
+            if (auto tracker = make_tracker(_net_exec, url, _metadata.info_hash, _nc, _udp_mux, _http_pool, _dns)) {
+                tier.push_back(_tracker_list.size());
+                _tracker_list.push_back(TrackerState{ std::move(tracker) });
+            }
         }
     };
 
-    // TEMPORARILY REJECT HTTP TRACKERS (because they are rarely used)
-    // custom created torrent files from magnet links will contain HTTP trackers
-    if (!_metadata.announce.contains("http://")) add(_metadata.announce);
+    // BEP 12, announce is only used when there is no announce-list
+    if (_metadata.announce_list.empty()) add(_tiers.emplace_back(), _metadata.announce);
 
     for (const auto& tier : _metadata.announce_list) {
-        for (const auto& url : tier) if (!url.contains("http://")) add(url);
+        auto& indices = _tiers.emplace_back();
+        for (const auto& url : tier) add(indices, url);
+    }
+
+    std::erase_if(_tiers, [](const auto& tier) { return tier.empty(); });
+
+    // spreads the torrents sharing a tier over its trackers
+    for (auto& tier: _tiers) std::ranges::shuffle(tier, _rng);
+}
+
+std::vector<std::shared_ptr<BaseTracker>> TorrentSession::trackers() const {
+    std::vector<std::shared_ptr<BaseTracker>> out;
+    out.reserve(_tracker_list.size());
+
+    for (const auto& state: _tracker_list) out.push_back(state._tracker_shared_ptr);
+    return out;
+}
+
+// rates over the time since the previous tick
+void TorrentSession::sample_disk_rates() {
+    auto stats = _fm.stats().snapshot();
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration<double>(now - _disk_sample.time).count();
+
+    if (_disk_sample.time != std::chrono::steady_clock::time_point{} && elapsed > 0) {
+        _disk_read_rate = static_cast<uint64_t>((stats.bytes_read - _disk_sample.bytes_read) / elapsed);
+        _disk_write_rate = static_cast<uint64_t>((stats.bytes_written - _disk_sample.bytes_written) / elapsed);
     }
+
+    _disk_sample = { now, stats.bytes_read, stats.bytes_written };
 }
 
 TorrentSnapshot TorrentSession::snapshot() const {
@@ -158,6 +378,16 @@ TorrentSnapshot TorrentSession::snapshot() const {
     cs.peers = _peer_connections.size();
     cs.trackers = _tracker_list.size();
 
+    cs.disk_queue_bytes = _pm.disk_queue_bytes();
+    cs.disk_queue_jobs = _pm.disk_queue_jobs();
+    cs.disk_throttled = _pm.disk_throttled();
+
+    cs.disk = _fm.stats().snapshot();
+    cs.disk.pending = _fm.disk_pending();
+
+    cs.disk.read_rate = _disk_read_rate;
+    cs.disk.write_rate = _disk_write_rate;
+
     cs.status = _pm.is_complete() ? "completed" : session_stopped ? "paused" : "downloading";
 
     return cs;
@@ -187,7 +417,7 @@ std::vector<TrackerSnapshot> TorrentSession::tracker_snapshots() const {
     std::vector<TrackerSnapshot> out;
     out.reserve(_tracker_list.size());
 
-    for (const auto& [ptr, stats, timer]: _tracker_list) {
+    for (const auto& [ptr, stats, started]: _tracker_list) {
         TrackerSnapshot ts;
         
         ts.url = std::string(ptr->url());
@@ -195,6 +425,13 @@ std::vector<TrackerSnapshot> TorrentSession::tracker_snapshots() const {
         ts.interval = stats.interval;
         ts.reachable = stats.reachable;
         ts.status = stats.status;
+
+        if (const auto& scrape = ptr->scrape_stats()) {
+            ts.seeders = scrape->seeders;
+            ts.leechers = scrape->leechers;
+            ts.completed = scrape->completed;
+            ts.scraped = true;
+        }
         
         // calculate next announce
         auto delta = stats.next_announce - std::chrono::steady_clock::now();
@@ -212,6 +449,8 @@ boost::asio::awaitable<void> TorrentSession::add_inbound_peer(boost::asio::ip::t
     // absolutely insane, not adding the strand breaks the frontend but makes inbound connections work
     // co_await boost::asio::post(peer_list_strand, boost::asio::use_awaitable);
 
+    if (!_resume_loaded || session_stopped) co_return;
+
     Peer p(ep.address(), ep.port(), id);
 
     auto [it, inserted] = _peer_connections.try_emplace(p);
@@ -219,7 +458,7 @@ boost::asio::awaitable<void> TorrentSession::add_inbound_peer(boost::asio::ip::t
     if (inserted) {
         // std::println("Peer {} about to be inserted", ep.address().to_string());
         it->second = std::make_shared<PeerConnection>(
-            std::move(socket), p, _metadata.info_hash, peer_id, _metadata.piece_hashes.size(), _pm, dir
+            std::move(socket), p, _metadata.info_hash, peer_id, _metadata.num_pieces(), _pm, dir
         );
         boost::asio::co_spawn(_net_exec, run_peer(it->second), boost::asio::detached);
     }
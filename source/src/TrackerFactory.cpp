@@ -1,11 +1,13 @@
 #include "TrackerFactory.hpp"
-#include "HttpsTracker.hpp"
+#include "HttpTracker.hpp"
 #include "UdpTracker.hpp"
 #include "NetworkCapabilities.hpp"
 
-std::shared_ptr<BaseTracker> make_tracker(boost::asio::any_io_executor exec, const std::string_view url, const std::array<unsigned char, 20>& info_hash, const NetworkCapabilities& nc) {
-    // if (url.starts_with("http://")) return std::make_unique<HttpTracker>(url);
-    if (url.starts_with("https://")) return std::make_shared<HttpsTracker>(exec, url, info_hash, nc);
-    else if (url.starts_with("udp://")) return std::make_shared<UdpTracker>(exec, url, info_hash, nc);
+std::shared_ptr<BaseTracker> make_tracker(boost::asio::any_io_executor exec, const std::string_view url, const std::array<unsigned char, 20>& info_hash, const NetworkCapabilities& nc, UdpTrackerMux& udp_mux, HttpConnectionPool& http_pool, DnsCache& dns) {
+    if (url.starts_with("http://") || url.starts_with("https://")) return std::make_shared<HttpTracker>(exec, url, info_hash, nc, http_pool);
+    else if (url.starts_with("udp://")) return std::make_shared<UdpTracker>(exec, url, info_hash, nc, udp_mux, dns);
     // throw std::invalid_argument("Unsupported tracker URL: " + url);
+
+    // websocket trackers and the like, skipped by the session
+    return nullptr;
 }
@@ -5,57 +5,36 @@
         return rng();
     }
 
-    boost::asio::awaitable<bool> UdpTracker::send_connect(UdpContext& context) {
-        size_t off{};
-        std::array<unsigned char, 16> buf{};
-        boost::system::error_code ec;
-
-        if (!context.connected) {
-            co_await context.socket.async_connect(context.endpoint, net::redirect_error(net::use_awaitable, ec));
-            if (ec || stopped) co_return false;
-            context.connected = true;
-        }
-        auto transaction_id = random_u32();
+    boost::asio::awaitable<std::optional<UdpTrackerMux::Datagram>> UdpTracker::send_request(UdpContext& context, std::span<unsigned char> request) {
+        const auto retry = _mux.retry_policy();
 
-        write_buffer(buf, 0x41727101980ULL, off);
-        write_buffer(buf, static_cast<uint32_t>(0), off);
-        write_buffer(buf, transaction_id, off);
+        for (unsigned n{}; n <= retry.max_retries && !stopped; ++n) {
+            auto timeout = retry.timeout(n);
 
-        co_await context.socket.async_send(net::buffer(buf), net::redirect_error(net::use_awaitable, ec));
-        if (ec || stopped) co_return false;
+            // connects again when the cached id expired, a timed out connect counts as an attempt like an unanswered request
+            auto connection_id = co_await _mux.connection_id(context.endpoint, timeout, this);
+            if (!connection_id || stopped) continue;
 
-        std::array<unsigned char, 16> response_buf{};
-        co_await context.socket.async_receive(net::buffer(response_buf), net::redirect_error(net::use_awaitable, ec));
-        if (ec || stopped) co_return false;
+            size_t off{};
+            write_buffer(request, *connection_id, off);
 
-        uint32_t action, return_transaction_id;
-        uint64_t conn;
-
-        std::memcpy(&action, response_buf.data(), 4);
-        std::memcpy(&return_transaction_id, response_buf.data() + 4, 4);
-        std::memcpy(&conn, response_buf.data() + 8, 8);
-
-        boost::endian::big_to_native_inplace(action);
-        boost::endian::big_to_native_inplace(return_transaction_id);
-        boost::endian::big_to_native_inplace(conn);
-
-        if (action != 0 || transaction_id != return_transaction_id) co_return false;
-        context.connection_id = conn;
-        context.expiry = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+            auto response = co_await _mux.transact(context.endpoint, request, timeout, this);
+            if (response) co_return response;
+        }
 
-        co_return true;
+        co_return std::nullopt;
     }
 
-    boost::asio::awaitable<TrackerResponse> UdpTracker::send_announce(UdpContext& context, const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total) {
+    boost::asio::awaitable<TrackerResponse> UdpTracker::send_announce(UdpContext& context, const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total, TrackerEvent event) {
         size_t off{};
         std::array<unsigned char, 98> buf{};
-        boost::system::error_code ec;
 
-        auto transaction_id = random_u32();
-
-        write_buffer(buf, context.connection_id, off);
+        // connection id, filled in for every attempt
+        off += 8;
         write_buffer(buf, static_cast<uint32_t>(1), off);
-        write_buffer(buf, transaction_id, off);
+
+        // transaction id, filled in by the mux
+        off += 4;
 
         std::memcpy(buf.data() + off, _info_hash.data(), 20); off += 20;
         std::memcpy(buf.data() + off, peer_id.data(), 20); off += 20;
@@ -64,94 +43,70 @@
         write_buffer(buf, total - downloaded, off);
         write_buffer(buf, uploaded, off);
 
-        uint32_t event = 0; // default: none
-
-        if (downloaded == 0) event = 2; // started
-        // later when completed:
-        else if (downloaded == total) event = 1;
-        // on shutdown:
-        // event = 3;
-
-        write_buffer(buf, event, off);
+        write_buffer(buf, static_cast<uint32_t>(event), off);
         write_buffer(buf, static_cast<uint32_t>(0), off);
         write_buffer(buf, random_u32(), off);
         write_buffer(buf, 0xFFFFFFFF, off);
         write_buffer(buf, static_cast<uint16_t>(6881), off);
 
-        co_await context.socket.async_send(net::buffer(buf), net::redirect_error(net::use_awaitable, ec));
-        if (ec || stopped) co_return TrackerResponse{ {}, 180, ec.message() };
+        auto response = co_await send_request(context, buf);
+        if (stopped) co_return TrackerResponse{ {}, 180, "Stopped" };
+        if (!response) co_return TrackerResponse{ {}, 180, "UDP tracker timed out" };
 
-        std::array<unsigned char, 1500> response_buf{};
+        auto size = response->size();
+        if (size < 8) co_return TrackerResponse{ {}, 180, "Incomplete UDP packet"};
 
-        auto size = co_await context.socket.async_receive(net::buffer(response_buf), net::redirect_error(net::use_awaitable, ec));
-        if (ec || stopped) co_return TrackerResponse{ {}, 180, ec.message() };
+        uint32_t action, interval{};
 
-        if (size < 20) co_return TrackerResponse{ {}, 180, "Incomplete UDP packet"};
+        std::memcpy(&action, response->data(), 4);
+        boost::endian::big_to_native_inplace(action);
 
-        uint32_t action, return_transaction_id, interval;
+        // error, the message follows the header
+        if (action == 3) {
+            _mux.forget_connection(context.endpoint);
+            co_return TrackerResponse{ {}, 180, std::string(response->begin() + 8, response->end()) };
+        }
 
-        std::memcpy(&action, response_buf.data(), 4);
-        std::memcpy(&return_transaction_id, response_buf.data() + 4, 4);
-        std::memcpy(&interval, response_buf.data() + 8, 4);
+        if (action != 1 || size < 20) co_return TrackerResponse{ {}, 180, "Invalid UDP announce response"};
 
-        boost::endian::big_to_native_inplace(action);
-        boost::endian::big_to_native_inplace(return_transaction_id);
+        std::memcpy(&interval, response->data() + 8, 4);
         boost::endian::big_to_native_inplace(interval);
 
-        if (action != 1 || return_transaction_id != transaction_id) co_return TrackerResponse{ {}, 180, "Invalid UDP announce response"};
-
         TrackerResponse out;
 
-        if (context.proto == udp::v4()) parse_v4(out, response_buf, size);
-        else if (context.proto == udp::v6()) parse_v6(out, response_buf, size);
+        if (context.proto == udp::v4()) parse_v4(out, *response);
+        else if (context.proto == udp::v6()) parse_v6(out, *response);
 
         out.interval = interval;
 
         co_return out;
     }
 
-    boost::asio::awaitable<bool> UdpTracker::ensure_socket_ready(UdpContext& context) {
-        boost::system::error_code ec;
-
-        if (!context.bound) {
-            context.socket.bind(udp::endpoint(context.proto, 0), ec);
-            if (ec) co_return false;
-            context.bound = true;
-        }
+    // asked again before every announce, the cache answers without a lookup until the entry expires
+    boost::asio::awaitable<bool> UdpTracker::ensure_endpoint(UdpContext& context) {
+        auto entry = co_await _dns.lookup(_host);
+        if (stopped) co_return false;
 
-        if (context.endpoint.port() == 0) {
-            udp::resolver resolver(_exec);
-
-            auto results = co_await resolver.async_resolve(context.proto, _host, std::to_string(_port), net::redirect_error(net::use_awaitable, ec));
-            if (ec || results.empty() || stopped) co_return false;
-
-            for (auto& r: results) {
-                auto ep = r.endpoint();
-
-                if (context.proto == udp::v4() && ep.address().is_v4()) context.endpoint = ep;
-                else if (context.proto == udp::v6() && ep.address().is_v6()) context.endpoint = ep;
-            }
-        }
+        const auto& addresses = context.proto == udp::v4() ? entry->v4 : entry->v6;
+        if (addresses.empty()) co_return false;
 
+        context.endpoint = udp::endpoint(addresses.front(), _port);
         co_return true;
     }
 
-boost::asio::awaitable<TrackerResponse> UdpTracker::async_announce(const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total) {
+boost::asio::awaitable<TrackerResponse> UdpTracker::async_announce(const std::string& peer_id, uint64_t downloaded, uint64_t uploaded, uint64_t total, TrackerEvent event) {
     TrackerResponse out;
     bool any_success = false;
 
-    auto now = std::chrono::steady_clock::now();
-
     // IPv4 path
     if (udp_v4) {
         try {
-            if (co_await ensure_socket_ready(*udp_v4)) {
-                if (udp_v4->connection_id == 0 || now >= udp_v4->expiry) co_await send_connect(*udp_v4);
-
-                auto r4 = co_await send_announce(*udp_v4, peer_id, downloaded, uploaded, total);
+            if (co_await ensure_endpoint(*udp_v4)) {
+                auto r4 = co_await send_announce(*udp_v4, peer_id, downloaded, uploaded, total, event);
                 out.peers.insert(out.peers.end(), r4.peers.begin(), r4.peers.end());
                 out.interval = r4.interval;
-                any_success = true;
+                out.error = r4.error;
+                any_success = r4.error.empty();
             }
         }
         catch (...) {}
@@ -160,30 +115,77 @@ boost::asio::awaitable<TrackerResponse> UdpTracker::async_announce(const std::st
     // IPv6 path
     if (udp_v6) {
         try {
-            if (co_await ensure_socket_ready(*udp_v6)) {
-                if (udp_v6->connection_id == 0 || now >= udp_v6->expiry) co_await send_connect(*udp_v6);
-
-                auto r6 = co_await send_announce(*udp_v6, peer_id, downloaded, uploaded, total);
+            if (co_await ensure_endpoint(*udp_v6)) {
+                auto r6 = co_await send_announce(*udp_v6, peer_id, downloaded, uploaded, total, event);
                 out.peers.insert(out.peers.end(), r6.peers.begin(), r6.peers.end());
 
-                if (out.interval == 0 || r6.interval < out.interval) out.interval = r6.interval;
-
-                any_success = true;
+                if (r6.error.empty()) {
+                    if (!out.interval || r6.interval < out.interval) out.interval = r6.interval;
+                    if (!any_success) out.error.clear();
+                    any_success = true;
+                }
             }
         }
         catch (...) {}
     }
 
     if (any_success) co_return out;
-    co_return TrackerResponse{ {}, 180, "UDP tracker unreachable" };
+    co_return TrackerResponse{ {}, 180, out.error.empty() ? "UDP tracker unreachable" : out.error };
 }
 
 
 
-void UdpTracker::parse_v4(TrackerResponse& out, std::array<unsigned char, 1500>& response_buf, size_t size) {
+boost::asio::awaitable<std::vector<std::optional<ScrapeStats>>> UdpTracker::scrape(std::span<const std::array<unsigned char, 20>> info_hashes) {
+    std::vector<std::optional<ScrapeStats>> out(info_hashes.size());
+
+    // scrape counts are per torrent, not per address family, one of them is enough
+    UdpContext* context = nullptr;
+    if (udp_v4 && co_await ensure_endpoint(*udp_v4)) context = &*udp_v4;
+    else if (udp_v6 && co_await ensure_endpoint(*udp_v6)) context = &*udp_v6;
+
+    if (!context) co_return out;
+
+    std::vector<unsigned char> buf;
+    buf.reserve(16 + MAX_SCRAPE_HASHES * 20);
+
+    for (size_t first{}; first < info_hashes.size() && !stopped; first += MAX_SCRAPE_HASHES) {
+        auto batch = info_hashes.subspan(first, std::min(MAX_SCRAPE_HASHES, info_hashes.size() - first));
+
+        // connection id and transaction id are filled in when sending
+        size_t off{ 8 };
+        buf.assign(16 + batch.size() * 20, 0);
+        write_buffer(buf, static_cast<uint32_t>(2), off);
+
+        off = 16;
+        for (const auto& hash: batch) { std::memcpy(buf.data() + off, hash.data(), 20); off += 20; }
+
+        auto response = co_await send_request(*context, buf);
+        if (!response || response->size() < 8) continue;
+
+        uint32_t action;
+        std::memcpy(&action, response->data(), 4);
+        boost::endian::big_to_native_inplace(action);
+
+        if (action == 3) _mux.forget_connection(context->endpoint);
+        if (action != 2) continue;
+
+        // seeders, completed, leechers for each hash in the order asked, a short answer leaves the rest unknown
+        for (size_t i{}; i < batch.size() && 8 + (i + 1) * 12 <= response->size(); ++i) {
+            std::array<uint32_t, 3> counts;
+            std::memcpy(counts.data(), response->data() + 8 + i * 12, 12);
+            for (auto& c: counts) boost::endian::big_to_native_inplace(c);
+
+            out[first + i] = ScrapeStats{ counts[0], counts[1], counts[2] };
+        }
+    }
+
+    co_return out;
+}
+
+void UdpTracker::parse_v4(TrackerResponse& out, std::span<const unsigned char> response) {
         // parse ipv4 peers, 4 bytes -> address, 2 bytes -> port
-        for (size_t i{20}; i + 6 <= size; i += 6) {
-            auto* peer = response_buf.data() + i;
+        for (size_t i{20}; i + 6 <= response.size(); i += 6) {
+            auto* peer = response.data() + i;
 
             boost::asio::ip::address_v4::bytes_type bytes {
                 peer[0], peer[1], peer[2], peer[3]
@@ -197,10 +199,10 @@ void UdpTracker::parse_v4(TrackerResponse& out, std::array<unsigned char, 1500>&
         }
 }
 
-void UdpTracker::parse_v6(TrackerResponse& out, std::array<unsigned char, 1500>& response_buf, size_t size) {
+void UdpTracker::parse_v6(TrackerResponse& out, std::span<const unsigned char> response) {
         // parse ipv6 peers, 16 bytes -> address, 2 bytes -> port
-        for (size_t i{20}; i + 18 <= size; i += 18) {
-            auto* peer = response_buf.data() + i;
+        for (size_t i{20}; i + 18 <= response.size(); i += 18) {
+            auto* peer = response.data() + i;
 
             boost::asio::ip::address_v6::bytes_type bytes{};
             std::memcpy(bytes.data(), peer, 16);
@@ -217,14 +219,6 @@ void UdpTracker::parse_v6(TrackerResponse& out, std::array<unsigned char, 1500>&
 void UdpTracker::stop() {
     stopped = true;
 
-    if (udp_v4) {
-        boost::system::error_code ec;
-        udp_v4->socket.cancel(ec);
-        udp_v4->socket.close(ec);
-    }
-    if (udp_v6) {
-        boost::system::error_code ec;
-        udp_v6->socket.cancel(ec);
-        udp_v6->socket.close(ec);
-    }
-}
\ No newline at end of file
+    // the sockets are shared, only our own requests are woken
+    _mux.cancel(this);
+}
@@ -0,0 +1,167 @@
+#include "UdpTrackerMux.hpp"
+#include "NetworkCapabilities.hpp"
+
+#include <random>
+#include <cstring>
+
+#include <boost/endian/conversion.hpp>
+
+namespace net = boost::asio;
+
+namespace {
+    uint32_t random_u32() {
+        static std::mt19937 rng{ std::random_device{}() };
+        return rng();
+    }
+
+    template <typename Value>
+    Value read_big(const unsigned char* p) {
+        Value v;
+        std::memcpy(&v, p, sizeof(Value));
+        return boost::endian::big_to_native(v);
+    }
+}
+
+UdpTrackerMux::UdpTrackerMux(boost::asio::any_io_executor exec, const NetworkCapabilities& nc, UdpRetryPolicy retry): _strand(net::make_strand(exec)), _nc(nc), _retry(retry) {}
+
+boost::asio::awaitable<std::optional<UdpTrackerMux::Datagram>> UdpTrackerMux::transact(udp::endpoint endpoint, std::span<unsigned char> request, std::chrono::milliseconds timeout, const void* owner) {
+    co_return co_await net::co_spawn(_strand, do_transact(endpoint, request, timeout, owner), net::use_awaitable);
+}
+
+boost::asio::awaitable<std::optional<uint64_t>> UdpTrackerMux::connection_id(udp::endpoint endpoint, std::chrono::milliseconds timeout, const void* owner) {
+    co_return co_await net::co_spawn(_strand, do_connection_id(endpoint, timeout, owner), net::use_awaitable);
+}
+
+void UdpTrackerMux::forget_connection(const udp::endpoint& endpoint) {
+    net::dispatch(_strand, [this, endpoint] {
+        auto it = _connections.find(endpoint);
+        if (it != _connections.end()) it->second.id = 0;
+    });
+}
+
+void UdpTrackerMux::cancel(const void* owner) {
+    net::dispatch(_strand, [this, owner] {
+        std::erase_if(_pending, [owner](auto& entry) {
+            if (entry.second.owner != owner) return false;
+            entry.second.timer->cancel();
+            return true;
+        });
+    });
+}
+
+UdpTrackerMux::udp::socket* UdpTrackerMux::socket_for(const udp::endpoint& endpoint) {
+    bool v6 = endpoint.address().is_v6();
+    if (v6 && !_nc.ipv6_outbound) return nullptr;
+
+    auto& socket = v6 ? _v6 : _v4;
+    if (socket) return socket->is_open() ? &*socket : nullptr;
+
+    auto proto = v6 ? udp::v6() : udp::v4();
+    socket.emplace(_strand, proto);
+
+    boost::system::error_code ec;
+    socket->bind(udp::endpoint(proto, 0), ec);
+    if (ec) {
+        socket->close(ec);
+        return nullptr;
+    }
+
+    net::co_spawn(_strand, receive_loop(*socket), net::detached);
+    return &*socket;
+}
+
+boost::asio::awaitable<std::optional<UdpTrackerMux::Datagram>> UdpTrackerMux::do_transact(udp::endpoint endpoint, std::span<unsigned char> request, std::chrono::milliseconds timeout, const void* owner) {
+    auto* socket = socket_for(endpoint);
+    if (!socket || request.size() < 16) co_return std::nullopt;
+
+    // ids only have to be unique among the requests waiting right now
+    uint32_t transaction_id;
+    do transaction_id = random_u32(); while (_pending.contains(transaction_id));
+
+    auto be = boost::endian::native_to_big(transaction_id);
+    std::memcpy(request.data() + 12, &be, 4);
+
+    std::optional<Datagram> response;
+    net::steady_timer timer(_strand, timeout);
+
+    _pending.emplace(transaction_id, Pending{ endpoint, owner, &timer, &response });
+
+    boost::system::error_code ec;
+    co_await socket->async_send_to(net::buffer(request.data(), request.size()), endpoint, net::redirect_error(net::use_awaitable, ec));
+
+    // the entry may already be gone and its id reused by another request
+    auto ours = [&] {
+        auto it = _pending.find(transaction_id);
+        return it != _pending.end() && it->second.response == &response ? it : _pending.end();
+    };
+
+    // the answer, or a cancel(), can come in while the send is still in flight, cancelling a timer nobody waits on yet does nothing
+    // woken by the timeout, by the receive loop handing over the response, or by cancel()
+    if (!ec && !response && ours() != _pending.end()) co_await timer.async_wait(net::redirect_error(net::use_awaitable, ec));
+
+    if (auto it = ours(); it != _pending.end()) _pending.erase(it);
+
+    co_return response;
+}
+
+boost::asio::awaitable<std::optional<uint64_t>> UdpTrackerMux::do_connection_id(udp::endpoint endpoint, std::chrono::milliseconds timeout, const void* owner) {
+    auto valid = [this, &endpoint] {
+        auto& c = _connections[endpoint];
+        return c.id != 0 && std::chrono::steady_clock::now() < c.expiry;
+    };
+
+    if (valid()) co_return _connections[endpoint].id;
+
+    // someone else is connecting already, take whatever they get
+    if (auto connecting = _connections[endpoint].connecting) {
+        boost::system::error_code ec;
+        co_await connecting->async_wait(net::redirect_error(net::use_awaitable, ec));
+
+        if (valid()) co_return _connections[endpoint].id;
+        co_return std::nullopt;
+    }
+
+    auto connecting = std::make_shared<net::steady_timer>(_strand, net::steady_timer::time_point::max());
+    _connections[endpoint].connecting = connecting;
+
+    std::array<unsigned char, 16> request{};
+    auto protocol_id = boost::endian::native_to_big(0x41727101980ULL);
+    std::memcpy(request.data(), &protocol_id, 8);
+
+    auto response = co_await do_transact(endpoint, request, timeout, owner);
+
+    auto& c = _connections[endpoint];
+    c.connecting.reset();
+    connecting->cancel();
+
+    if (!response || response->size() < 16 || read_big<uint32_t>(response->data()) != 0) co_return std::nullopt;
+
+    c.id = read_big<uint64_t>(response->data() + 8);
+    c.expiry = std::chrono::steady_clock::now() + CONNECTION_ID_LIFETIME;
+
+    co_return c.id;
+}
+
+boost::asio::awaitable<void> UdpTrackerMux::receive_loop(udp::socket& socket) {
+    std::vector<unsigned char> buf(MAX_DATAGRAM);
+    udp::endpoint from;
+
+    while (socket.is_open()) {
+        boost::system::error_code ec;
+        auto size = co_await socket.async_receive_from(net::buffer(buf), from, net::redirect_error(net::use_awaitable, ec));
+
+        if (ec == net::error::operation_aborted) co_return;
+
+        // windows reports an icmp unreachable from an earlier send as an error on the next receive, the socket is still fine
+        if (ec || size < 8) continue;
+
+        auto it = _pending.find(read_big<uint32_t>(buf.data() + 4));
+
+        // a late answer to a request that timed out, or a datagram from somewhere else
+        if (it == _pending.end() || it->second.endpoint != from) continue;
+
+        it->second.response->emplace(buf.begin(), buf.begin() + size);
+        it->second.timer->cancel();
+        _pending.erase(it);
+    }
+}